@@ -10,6 +10,9 @@
 #include <algorithm>
 #include <queue>
 #include <sstream>
+#include "src/EdgeListSimilarityEngine.h"
+#include "src/Kernels.h"
+#include "src/ModelFile.h"
 using namespace std;
 
 #define rep(i, a, b) for(int i = (a); i < int(b); ++i)
@@ -91,7 +94,7 @@ string capitalize(string s){
 	return s;
 }
 
-void processWord2Vec(const char* inFile, const char* popFile, const char* outFile, const char* wordlistFile, int modelid, int limit) {
+void processWord2Vec(const char* inFile, const char* popFile, const char* outFile, const char* wordlistFile, int modelid, int limit, int version) {
 	string line;
 	set<string> wordlist;
 	ifstream fin(wordlistFile);
@@ -179,9 +182,22 @@ void processWord2Vec(const char* inFile, const char* popFile, const char* outFil
 			cerr << w << endl;
 	}
 
+	if (version == ModelHeader::VERSION) {
+		vector<string> names;
+		vector<float> norms, vectors;
+		trav(w, words) {
+			if (w.word.empty()) continue;
+			names.push_back(w.word);
+			norms.push_back(w.norm);
+			vectors.insert(vectors.end(), all(w.vec));
+		}
+		if (!writeModelFile(outFile, modelid, dim, names, norms, vectors))
+			exit(1);
+		return;
+	}
+
 	ofstream fout(outFile, ios::binary);
 	int sentinel = -1;
-	int version = 1;
 	fout.write((char*)&sentinel, sizeof sentinel);
 	fout.write((char*)&version, sizeof version);
 	fout.write((char*)&modelid, sizeof modelid);
@@ -198,9 +214,175 @@ void processWord2Vec(const char* inFile, const char* popFile, const char* outFil
 	fout.close();
 }
 
+// Prints how many of the 10 nearest neighbours of some sample words stay the same when the
+// vectors are quantized
+void reportQuantizationOverlap(const vector<float>& vectors, int numberOfWords, int dim, VectorType type) {
+	const int k = 10, queries = 100;
+	// The bots only ever consider the most common words, so that is where precision matters
+	int n = min(numberOfWords, 50000);
+	vector<float> decoded((size_t)n * dim);
+	vector<uint16_t> half(dim);
+	vector<int8_t> bytes(dim);
+	rep(i, 0, n) {
+		const float* row = &vectors[(size_t)i * dim];
+		float* out = &decoded[(size_t)i * dim];
+		if (type == VectorType::FP16) {
+			quantizeHalf(row, half.data(), dim);
+			dequantizeHalf(half.data(), out, dim);
+		} else {
+			float scale = quantizeByte(row, bytes.data(), dim);
+			dequantizeByte(bytes.data(), scale, out, dim);
+		}
+	}
+
+	auto topK = [&](const float* query, const vector<float>& rows, int self) {
+		vector<pair<float, int>> sims;
+		rep(i, 0, n) {
+			if (i != self) sims.push_back({-dotProduct(query, &rows[(size_t)i * dim], dim), i});
+		}
+		partial_sort(sims.begin(), sims.begin() + min(k, sz(sims)), sims.end());
+		set<int> ret;
+		rep(i, 0, min(k, sz(sims))) ret.insert(sims[i].second);
+		return ret;
+	};
+
+	int total = 0, same = 0;
+	for (int q = 0; q < queries && q < n; q++) {
+		int index = (int)((ll)q * n / min(queries, n));
+		set<int> exact = topK(&vectors[(size_t)index * dim], vectors, index);
+		set<int> approx = topK(&decoded[(size_t)index * dim], decoded, index);
+		trav(x, exact) same += approx.count(x);
+		total += sz(exact);
+	}
+	cerr << "Top-" << k << " overlap with fp32 over " << min(queries, n) << " sample words: "
+		 << fixed << setprecision(1) << (total ? 100.0 * same / total : 100.0) << "%" << endl;
+}
+
+// Converts a version 0/1 .bin file into the memory-mappable version 2 format
+void convertModel(const char* inFile, const char* outFile, VectorType type) {
+	ifstream fin(inFile, ios::binary);
+	int numberOfWords, dim, modelid = 0, version = 0;
+	fin.read((char*)&numberOfWords, sizeof numberOfWords);
+	if (fin && numberOfWords == -1) {
+		fin.read((char*)&version, sizeof version);
+		fin.read((char*)&modelid, sizeof modelid);
+		fin.read((char*)&numberOfWords, sizeof numberOfWords);
+	}
+	fin.read((char*)&dim, sizeof dim);
+	if (!fin || version >= ModelHeader::VERSION) {
+		cerr << "Unable to read " << inFile << " as a version 0 or 1 model" << endl;
+		exit(1);
+	}
+
+	vector<string> names(numberOfWords);
+	vector<float> norms(numberOfWords, 1.0f);
+	vector<float> vectors((size_t)numberOfWords * dim);
+	rep(i, 0, numberOfWords) {
+		int len;
+		fin.read((char*)&len, sizeof len);
+		if (!fin || len <= 0 || len > (1 << 16)) {
+			cerr << "Failed at reading entry " << i << endl;
+			exit(1);
+		}
+		names[i].resize(len);
+		fin.read(&names[i][0], len);
+		if (version >= 1)
+			fin.read((char*)&norms[i], sizeof(float));
+		fin.read((char*)&vectors[(size_t)i * dim], dim * sizeof(float));
+	}
+	if (!fin) {
+		cerr << "Failed to read " << inFile << endl;
+		exit(1);
+	}
+	if (type != VectorType::FP32)
+		reportQuantizationOverlap(vectors, numberOfWords, dim, type);
+	if (!writeModelFile(outFile, modelid, dim, names, norms, vectors, type))
+		exit(1);
+}
+
+// Converts a text edge list ("word1 word2 weight" lines after the number of edges) into the
+// binary format of EdgeListSimilarityEngine, which stores every word only once
+void convertEdges(const char* inFile, const char* outFile) {
+	ifstream fin(inFile);
+	int numEdges;
+	if (!(fin >> numEdges)) {
+		cerr << "Failed to read " << inFile << endl;
+		exit(1);
+	}
+	map<string, int> index;
+	vector<string> words;
+	vector<pair<pii, float>> edges;
+	auto wordIndex = [&](const string& word) {
+		auto it = index.find(word);
+		if (it != index.end()) return it->second;
+		index[word] = sz(words);
+		words.push_back(word);
+		return sz(words) - 1;
+	};
+	rep(i, 0, numEdges) {
+		string a, b;
+		float weight;
+		if (!(fin >> a >> b >> weight)) {
+			cerr << "Failed to read edge " << i << " of " << inFile << endl;
+			exit(1);
+		}
+		edges.push_back({{wordIndex(a), wordIndex(b)}, weight});
+	}
+
+	ofstream fout(outFile, ios::binary);
+	auto writeInt = [&](int32_t x) { fout.write((const char*)&x, sizeof x); };
+	writeInt(EdgeListSimilarityEngine::FILE_MAGIC);
+	writeInt(EdgeListSimilarityEngine::FILE_VERSION);
+	writeInt(sz(words));
+	writeInt(sz(edges));
+	trav(word, words) {
+		writeInt(sz(word));
+		fout.write(word.data(), word.size());
+	}
+	trav(edge, edges) {
+		writeInt(edge.first.first);
+		writeInt(edge.first.second);
+		fout.write((const char*)&edge.second, sizeof edge.second);
+	}
+	if (!fout) {
+		cerr << "Failed to write " << outFile << endl;
+		exit(1);
+	}
+	cerr << "Wrote " << sz(edges) << " edges between " << sz(words) << " words" << endl;
+}
+
 int main(int argc, char **argv) {
+	if (argc == 4 && argv[1] == string("--edges")) {
+		convertEdges(argv[2], argv[3]);
+		return 0;
+	}
+
+	if ((argc == 4 || argc == 5) && argv[1] == string("--convert")) {
+		VectorType type = VectorType::FP32;
+		if (argc == 5) {
+			string name = argv[4];
+			if (name == "fp16") type = VectorType::FP16;
+			else if (name == "int8") type = VectorType::INT8;
+			else if (name != "fp32") {
+				cerr << "Unknown vector type " << name << ", expected fp32, fp16 or int8" << endl;
+				return 1;
+			}
+		}
+		convertModel(argv[2], argv[3], type);
+		return 0;
+	}
+
+	int version = 1;
+	if (argc >= 2 && argv[1] == string("--v2")) {
+		version = ModelHeader::VERSION;
+		argv++;
+		argc--;
+	}
+
 	if (argc != 6) {
-		cerr << "Usage: " << argv[0] << " <word2vec .txt file> <popularity .txt file> <model id> <limit> <outfile.bin>" << endl;
+		cerr << "Usage: " << argv[0] << " [--v2] <word2vec .txt file> <popularity .txt file> <model id> <limit> <outfile.bin>" << endl;
+		cerr << "       " << argv[0] << " --convert <infile.bin> <outfile.bin> [fp32|fp16|int8]" << endl;
+		cerr << "       " << argv[0] << " --edges <edges.txt> <edges.bin>" << endl;
 		cerr << endl;
 		cerr << "* The word2vec file should be a list of lines of the form \"word a_1 a_2 ... a_k\"," << endl;
 		cerr << " where k is the dimension of the word2vec embedding, a_i are real numbers in decimal form," << endl;
@@ -216,6 +398,13 @@ int main(int argc, char **argv) {
 		cerr << endl;
 		cerr << "* The limit indicates the number of words from the popularity file to use. 0 = unlimited." << endl;
 		cerr << " Around 50,000 is reasonable." << endl;
+		cerr << endl;
+		cerr << "* --v2 writes the memory-mappable version 2 format, which loads almost instantly." << endl;
+		cerr << " --convert turns an existing .bin file into that format, optionally storing the vectors" << endl;
+		cerr << " quantized to half precision floats or bytes, and reports how that changes nearest neighbours." << endl;
+		cerr << endl;
+		cerr << "* --edges converts an edge list such as generated_data/wikisaurus_edges.txt to the binary" << endl;
+		cerr << " format, which is used instead of the text file when it exists next to it." << endl;
 		return 1;
 	}
 
@@ -224,5 +413,5 @@ int main(int argc, char **argv) {
 	int modelid = atoi(argv[3]);
 	int limit = atoi(argv[4]);
 	const char* outFile = argv[5];
-	processWord2Vec(inFile, popFile, outFile, "wordlist.txt", modelid, limit);
+	processWord2Vec(inFile, popFile, outFile, "wordlist.txt", modelid, limit, version);
 }
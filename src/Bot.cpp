@@ -15,7 +15,7 @@ void Bot::addBoardWord(CardType type, const string &word) {
 	boardWords.push_back({type, word, dict.getID(word)});
 }
 
-bool Bot::forbiddenWord(const string &word) {
+bool Bot::forbiddenWord(string_view word) {
 	for (const BoardWord &w : boardWords) {
 		if (superOrSubstring(w.word, word))
 			return true;
@@ -23,6 +23,18 @@ bool Bot::forbiddenWord(const string &word) {
 	return false;
 }
 
+void Bot::markForbiddenWords(int count) {
+	count = min(count, dict.size());
+	if (!substringIndex || substringIndex->size() < count) {
+		substringIndex = make_shared<SubstringIndex>(dict, count);
+	}
+	forbiddenBitsSize = substringIndex->size();
+	forbiddenBits.assign((forbiddenBitsSize + 63) / 64, 0);
+	for (const BoardWord &w : boardWords) {
+		substringIndex->markConflicts(w.word, forbiddenBits);
+	}
+}
+
 void Bot::setWords(const vector<string> &_myWords, const vector<string> &_opponentWords,
 				   const vector<string> &_civilianWords, const vector<string> &_assassinWords) {
 	myWords = _myWords;
@@ -2,9 +2,13 @@
 
 #include "Dictionary.h"
 #include "InappropriateEngine.h"
+#include "SimilarityCache.h"
 #include "SimilarityEngine.h"
+#include "SubstringIndex.h"
 #include "Utilities.h"
 
+#include <cstdint>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -39,7 +43,24 @@ struct Bot {
 		}
 	};
 
-	InappropriateMode inappropriateMode;
+	struct ScanStats {
+		// Number of candidates that were considered
+		int candidates = 0;
+
+		// Number of candidates that were skipped without being scored, because they could not
+		// have made it into the results
+		int pruned = 0;
+	};
+
+	// Number of candidates whose similarities are computed in a single
+	// SimilarityEngine::similarityMatrix call when scanning the vocabulary
+	static const int SCAN_BLOCK_SIZE = 256;
+
+	// Number of threads that scan the vocabulary, 0 means one per hardware thread. The results
+	// do not depend on it.
+	int numThreads = 0;
+
+	InappropriateMode inappropriateMode = AllowInappropriate;
 
 	// Score multiplier for inappropriate words when using the BoostInappropriate mode
 	// See inappropriateMode
@@ -52,6 +73,21 @@ struct Bot {
 	std::vector<std::string> myWords, opponentWords, civilianWords, assassinWords;
 	std::vector<BoardWord> boardWords;
 
+	// Similarities between the candidate clues and the board words, kept between calls to
+	// findBestWords
+	SimilarityCache similarityCache;
+
+	// Statistics of the last call to findBestWords
+	ScanStats lastScanStats;
+
+	// Index of the candidate clues that #markForbiddenWords builds unless it is set beforehand.
+	// Bots with the same dictionary can share one.
+	std::shared_ptr<const SubstringIndex> substringIndex;
+
+	// Bit i is set if word i is forbidden, for the words marked by #markForbiddenWords
+	std::vector<uint64_t> forbiddenBits;
+	int forbiddenBitsSize = 0;
+
 	Bot(Dictionary &dict, SimilarityEngine &engine, InappropriateEngine &inappropriateEngine)
 		: dict(dict), engine(engine), inappropriateEngine(inappropriateEngine) {}
 
@@ -61,7 +97,20 @@ struct Bot {
 
 	void addBoardWord(CardType type, const std::string &word);
 
-	bool forbiddenWord(const std::string &word);
+	/** True if the word is a super or substring of a board word, which makes it an illegal clue */
+	bool forbiddenWord(std::string_view word);
+
+	/** Finds the forbidden words among the first count words of the dictionary with a few lookups
+	 * per board word, for #isForbidden. Call again when the board changes. */
+	void markForbiddenWords(int count);
+
+	/** Same as #forbiddenWord, but a bit lookup for the words marked by #markForbiddenWords */
+	inline bool isForbidden(wordID id) {
+		if ((int)id < forbiddenBitsSize) {
+			return (forbiddenBits[id >> 6] >> (id & 63)) & 1;
+		}
+		return forbiddenWord(dict.getWord(id));
+	}
 
 	void setWords(const std::vector<std::string> &_myWords,
 				  const std::vector<std::string> &_opponentWords,
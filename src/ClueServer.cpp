@@ -0,0 +1,228 @@
+#include "ClueServer.h"
+#include "Utilities.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+#define trav(x, v) for (auto &x : v)
+
+using namespace std;
+
+ClueServer::~ClueServer() {
+	if (listenFd != -1) {
+		close(listenFd);
+	}
+	if (!socketPath.empty()) {
+		unlink(socketPath.c_str());
+	}
+	trav(fd, wakeFds) {
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+}
+
+bool ClueServer::listen(const string &address) {
+	if (pipe(wakeFds) != 0) {
+		cerr << "Failed to create a pipe: " << strerror(errno) << endl;
+		return false;
+	}
+
+	bool isPort = !address.empty() && address.find_first_not_of("0123456789") == string::npos;
+	if (isPort) {
+		int port = atoi(address.c_str());
+		if (port <= 0 || port > 65535) {
+			cerr << "Invalid port " << address << endl;
+			return false;
+		}
+		listenFd = socket(AF_INET, SOCK_STREAM, 0);
+		int reuse = 1;
+		setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (listenFd == -1 || bind(listenFd, (sockaddr *)&addr, sizeof addr) != 0) {
+			cerr << "Failed to bind to port " << port << ": " << strerror(errno) << endl;
+			return false;
+		}
+	} else {
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (address.empty() || address.size() >= sizeof addr.sun_path) {
+			cerr << "Invalid socket path '" << address << "'" << endl;
+			return false;
+		}
+		strcpy(addr.sun_path, address.c_str());
+		// A socket file left behind by a server that did not shut down cleanly
+		unlink(address.c_str());
+		listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd == -1 || bind(listenFd, (sockaddr *)&addr, sizeof addr) != 0) {
+			cerr << "Failed to bind to " << address << ": " << strerror(errno) << endl;
+			return false;
+		}
+		socketPath = address;
+	}
+
+	if (::listen(listenFd, SOMAXCONN) != 0) {
+		cerr << "Failed to listen on " << address << ": " << strerror(errno) << endl;
+		return false;
+	}
+	return true;
+}
+
+bool ClueServer::readRequest(int fd, string &request) {
+	// The timeout covers the whole request, so that a client cannot keep a worker busy by
+	// sending a little at a time
+	typedef chrono::steady_clock Clock;
+	auto deadline = Clock::now() + chrono::seconds(readTimeoutSeconds);
+	char buf[1 << 12];
+	while (true) {
+		auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - Clock::now());
+		if (remaining.count() <= 0) {
+			return false;
+		}
+		pollfd p = {fd, POLLIN, 0};
+		int ready = poll(&p, 1, (int)remaining.count());
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready <= 0) {
+			return false;
+		}
+		ssize_t received = recv(fd, buf, sizeof buf, 0);
+		if (received == 0) {
+			return true;
+		}
+		if (received < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		request.append(buf, received);
+		if ((int)request.size() > MAX_REQUEST_SIZE) {
+			return false;
+		}
+	}
+}
+
+void ClueServer::serveConnection(int fd) {
+	string request;
+	if (readRequest(fd, request)) {
+		istringstream in(request);
+		ostringstream out;
+		try {
+			handler(in, out);
+		} catch (const exception &e) {
+			cerr << "Request failed: " << e.what() << endl;
+		}
+		string response = out.str();
+		size_t sent = 0;
+		while (sent < response.size()) {
+			ssize_t count = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if (count < 0 && errno == EINTR) {
+				continue;
+			}
+			if (count <= 0) {
+				break;
+			}
+			sent += count;
+		}
+	}
+	close(fd);
+}
+
+void ClueServer::worker() {
+	while (true) {
+		int fd;
+		{
+			unique_lock<mutex> lock(pendingMutex);
+			pendingChanged.wait(lock, [&] { return !pending.empty() || acceptDone; });
+			if (pending.empty()) {
+				return;
+			}
+			fd = pending.front();
+			pending.pop_front();
+		}
+		serveConnection(fd);
+	}
+}
+
+void ClueServer::stop() {
+	stopping = true;
+	char wake = 0;
+	if (write(wakeFds[1], &wake, 1) < 0) {
+		// The accept loop notices the flag on its next wake-up
+	}
+}
+
+void ClueServer::run(int numWorkers) {
+	// The signals are handled by a thread of their own, all other threads block them
+	sigset_t signals, previousSignals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &previousSignals);
+	thread signalThread([&] {
+		timespec interval = {0, 100 * 1000 * 1000};
+		while (!stopping) {
+			if (sigtimedwait(&signals, nullptr, &interval) > 0) {
+				stop();
+			}
+		}
+	});
+
+	acceptDone = false;
+	vector<thread> workers;
+	rep(i, 0, resolveThreadCount(numWorkers)) {
+		workers.emplace_back([&] { worker(); });
+	}
+
+	pollfd fds[2] = {{listenFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+	while (!stopping) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			cerr << "Failed to wait for connections: " << strerror(errno) << endl;
+			break;
+		}
+		if (!(fds[0].revents & POLLIN)) {
+			continue;
+		}
+		int fd = accept(listenFd, nullptr, nullptr);
+		if (fd == -1) {
+			continue;
+		}
+		lock_guard<mutex> lock(pendingMutex);
+		pending.push_back(fd);
+		pendingChanged.notify_one();
+	}
+
+	{
+		lock_guard<mutex> lock(pendingMutex);
+		acceptDone = true;
+		pendingChanged.notify_all();
+	}
+	trav(worker, workers) {
+		worker.join();
+	}
+	stopping = true;
+	signalThread.join();
+	pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/** Answers requests that arrive over a Unix domain socket or a TCP port on the loopback
+ * interface, one request per connection, on a pool of worker threads.
+ *
+ * A client sends its request and shuts down its side of the connection for writing (as with
+ * "nc -N"), just like a request on standard input ends with the end of the file. The connection
+ * is closed once the response has been sent.
+ */
+struct ClueServer {
+	/** Reads one request and writes its response */
+	typedef std::function<void(std::istream &, std::ostream &)> Handler;
+
+   private:
+	Handler handler;
+	std::string socketPath;
+	int listenFd = -1;
+
+	// The read end of wakeFds is watched next to the listening socket, #stop writes to the other
+	// end to interrupt the accept loop
+	int wakeFds[2] = {-1, -1};
+	std::atomic<bool> stopping{false};
+
+	// Accepted connections waiting for a worker
+	std::deque<int> pending;
+	bool acceptDone = false;
+	std::mutex pendingMutex;
+	std::condition_variable pendingChanged;
+
+	void worker();
+
+	void serveConnection(int fd);
+
+	/** Reads a request from the connection into request, returns false on errors and timeouts */
+	bool readRequest(int fd, std::string &request);
+
+   public:
+	// Requests larger than this are rejected
+	static const int MAX_REQUEST_SIZE = 1 << 20;
+
+	// Connections that do not send a complete request within this time are closed
+	int readTimeoutSeconds = 10;
+
+	ClueServer(Handler handler) : handler(handler) {}
+	~ClueServer();
+
+	/** Listens on a TCP port of 127.0.0.1 if address is a number, otherwise on a Unix domain
+	 * socket with address as its path. Returns true if successful. */
+	bool listen(const std::string &address);
+
+	/** Answers requests on numWorkers threads (see #resolveThreadCount) until #stop is called or
+	 * the process receives SIGINT or SIGTERM. Connections that were already accepted are still
+	 * answered before returning. */
+	void run(int numWorkers);
+
+	/** Makes #run return. Can be called from any thread. */
+	void stop();
+};
@@ -1,8 +1,11 @@
 #include "Dictionary.h"
 #include <fstream>
+#include <stdexcept>
 
 using namespace std;
 
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+
 string normalize(string s) {
 	for (auto& c : s) {
 		if ('A' <= c && c <= 'Z') {
@@ -23,9 +26,9 @@ string denormalize(string s) {
 	return s;
 }
 
-bool superOrSubstring(const string& a, const string& b) {
-	auto lowerA = normalize(a);
-	auto lowerB = normalize(b);
+bool superOrSubstring(string_view a, string_view b) {
+	auto lowerA = normalize(string(a));
+	auto lowerB = normalize(string(b));
 	return lowerA.find(lowerB) != string::npos || lowerB.find(lowerA) != string::npos;
 }
 
@@ -35,30 +38,90 @@ int Dictionary::getPopularity(wordID id) const {
 	return id + 1;
 }
 
-bool Dictionary::wordExists(const string& word) const {
-	return word2id.count(word) > 0;
+uint32_t Dictionary::hash(string_view word) {
+	uint32_t h = 2166136261u;
+	for (char c : word) {
+		h = (h ^ (uint8_t)c) * 16777619u;
+	}
+	return h;
+}
+
+int Dictionary::findSlot(string_view word) const {
+	uint32_t mask = (uint32_t)table.size() - 1;
+	uint32_t slot = hash(word) & mask;
+	for (;; slot = (slot + 1) & mask) {
+		int id = table[slot];
+		if (id == -1 || getWord((wordID)id) == word) {
+			return (int)slot;
+		}
+	}
+}
+
+void Dictionary::grow() {
+	vector<int32_t> old;
+	old.swap(table);
+	table.assign(max<size_t>(16, 2 * old.size()), -1);
+	rep(id, 0, size()) {
+		table[findSlot(getWord((wordID)id))] = id;
+	}
+}
+
+vector<int32_t> Dictionary::buildTable(const vector<string>& words) {
+	Dictionary dict;
+	for (const string& word : words) {
+		dict.addWord(word);
+	}
+	return dict.table;
 }
 
-wordID Dictionary::addWord(const string& word) {
-	if (!wordExists(word)) {
-		word2id.insert(make_pair(word, (wordID)words.size()));
-		words.push_back(word);
+bool Dictionary::loadPrebuilt(const char* data, const uint32_t* wordOffsets, int count,
+							  const int32_t* hashTable, int tableSize) {
+	if (size() != 0 || tableSize < 2 * count || (tableSize & (tableSize - 1)) != 0) {
+		return false;
+	}
+	rep(i, 0, tableSize) {
+		if (hashTable[i] < -1 || hashTable[i] >= count) {
+			return false;
+		}
+	}
+	arena.assign(data + wordOffsets[0], data + wordOffsets[count]);
+	offsets.resize(count + 1);
+	rep(i, 0, count + 1) {
+		offsets[i] = wordOffsets[i] - wordOffsets[0];
 	}
-	return getID(word);
+	table.assign(hashTable, hashTable + tableSize);
+	return true;
 }
 
-string& Dictionary::getWord(wordID id) {
-	return words[(int)id];
+bool Dictionary::wordExists(string_view word) const {
+	return !table.empty() && table[findSlot(word)] != -1;
 }
 
-wordID Dictionary::getID(const string& word) const {
-	return word2id.at(word);
+wordID Dictionary::addWord(string_view word) {
+	if (2 * (size() + 1) > (int)table.size()) {
+		grow();
+	}
+	int slot = findSlot(word);
+	if (table[slot] == -1) {
+		table[slot] = size();
+		arena.append(word.data(), word.size());
+		offsets.push_back((uint32_t)arena.size());
+	}
+	return (wordID)table[slot];
+}
+
+wordID Dictionary::getID(string_view word) const {
+	int id = table.empty() ? -1 : table[findSlot(word)];
+	if (id == -1) {
+		throw out_of_range("Unknown word " + string(word));
+	}
+	return (wordID)id;
 }
 
 /** Top N most popular words */
 vector<wordID> Dictionary::getCommonWords(int vocabularySize) const {
 	vector<wordID> ret;
-	vocabularySize = min(vocabularySize, (int)words.size());
+	vocabularySize = min(vocabularySize, size());
 	ret.reserve(vocabularySize);
 	for (int i = 0; i < vocabularySize; i++) {
 		ret.push_back(wordID(i));
@@ -1,7 +1,8 @@
 #pragma once
 
-#include <map>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 /** Represents a single word or phrase in a similarity engine */
@@ -12,36 +13,61 @@ std::string normalize(std::string s);
 std::string denormalize(std::string s);
 
 /** True if a is a super or substring of b or vice versa */
-bool superOrSubstring(const std::string& a, const std::string& b);
+bool superOrSubstring(std::string_view a, std::string_view b);
 
 struct Dictionary {
    private:
-	std::map<std::string, wordID> word2id;
-	std::vector<std::string> words;
+	// All words concatenated, word i spans [offsets[i], offsets[i+1])
+	std::string arena;
+	std::vector<uint32_t> offsets{0};
+
+	// Open addressing hash table with linear probing, holding word IDs or -1 for empty slots.
+	// Its size is a power of two, and it is kept at most half full.
+	std::vector<int32_t> table;
+
+	/** Slot holding the word, or the empty slot where it would be inserted */
+	int findSlot(std::string_view word) const;
+
+	void grow();
 
    public:
+	/** Hash function of the table, which model files rely on being stable (32-bit FNV-1a) */
+	static uint32_t hash(std::string_view word);
+
+	/** The hash table of a dictionary that holds exactly these words, added in this order */
+	static std::vector<int32_t> buildTable(const std::vector<std::string>& words);
+
+	/** Fills an empty dictionary with count words, given as the concatenated characters and
+	 * count + 1 offsets into them, and a hash table for them made by #buildTable. This skips
+	 * hashing every word, e.g. when loading a model file. Returns false, leaving the dictionary
+	 * unchanged, if the dictionary is not empty or the table does not fit. */
+	bool loadPrebuilt(const char* data, const uint32_t* wordOffsets, int count,
+					  const int32_t* hashTable, int tableSize);
+
 	/** Popularity of a word, the most popular word has a popularity of 1, the second most popular
 	 * has a popularity of 2 etc. */
 	int getPopularity(wordID id) const;
 
 	/** True if the dictionary includes the specified word */
-	bool wordExists(const std::string& word) const;
+	bool wordExists(std::string_view word) const;
 
 	/** Adds a word to the dictionary unless it already exists.
 	 * Returns the ID of the word (regardless of whether it was already in the dictionary or not).
 	 */
-	wordID addWord(const std::string& word);
+	wordID addWord(std::string_view word);
 
-	/** Word string corresponding to the ID */
-	std::string& getWord(wordID id);
+	/** Word string corresponding to the ID. Valid until the next word is added. */
+	inline std::string_view getWord(wordID id) const {
+		return std::string_view(arena.data() + offsets[id], offsets[id + 1] - offsets[id]);
+	}
 
-	/** ID representing a particular word */
-	wordID getID(const std::string& word) const;
+	/** ID representing a particular word. Throws std::out_of_range if it does not exist. */
+	wordID getID(std::string_view word) const;
 
 	/** Top N most popular words */
 	std::vector<wordID> getCommonWords(int vocabularySize) const;
 
 	inline int size() const {
-		return (int)words.size();
+		return (int)offsets.size() - 1;
 	}
 };
\ No newline at end of file
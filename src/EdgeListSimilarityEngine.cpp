@@ -18,39 +18,176 @@ float EdgeListSimilarityEngine::stat(wordID s) {
 
 /** Returns true if successful */
 bool EdgeListSimilarityEngine::load(const string &fileName, bool verbose) {
-	ifstream fin(fileName);
+	ifstream fin(fileName, ios::binary);
 	if (!fin) return false;
 
+	int32_t magic = 0;
+	fin.read((char *)&magic, sizeof magic);
+	if (fin && magic == FILE_MAGIC) {
+		return loadBinary(fin);
+	}
+	fin.clear();
+	fin.seekg(0);
+	return loadText(fin);
+}
+
+bool EdgeListSimilarityEngine::loadText(istream &in) {
+	vector<Edge> edges;
 	int numEdges;
-	fin >> numEdges;
+	in >> numEdges;
 	for (int i = 0; i < numEdges; i++) {
 		string a, b;
 		float weight;
-		fin >> a >> b >> weight;
+		in >> a >> b >> weight;
 		if (dict.wordExists(a) && dict.wordExists(b)) {
-			auto IDa = dict.getID(a);
-			auto IDb = dict.getID(b);
-			hasWord.insert(IDa);
-			hasWord.insert(IDb);
-			edges[make_pair(IDa, IDb)] = weight;
-			edges[make_pair(IDb, IDa)] = weight;
+			edges.push_back({dict.getID(a), dict.getID(b), weight});
+		}
+	}
+	buildAdjacency(edges);
+	return true;
+}
+
+bool EdgeListSimilarityEngine::loadBinary(istream &in) {
+	int32_t version, numWords, numEdges;
+	in.read((char *)&version, sizeof version);
+	in.read((char *)&numWords, sizeof numWords);
+	in.read((char *)&numEdges, sizeof numEdges);
+	if (!in || version != FILE_VERSION || numWords < 0 || numEdges < 0) {
+		cerr << "Invalid edge file" << endl;
+		return false;
+	}
+
+	// Words of the file that are not in the dictionary get -1
+	vector<int> ids(numWords);
+	string word;
+	rep(i, 0, numWords) {
+		int32_t len;
+		in.read((char *)&len, sizeof len);
+		if (!in || len < 0 || len > (1 << 16)) {
+			cerr << "Invalid edge file" << endl;
+			return false;
 		}
+		word.resize(len);
+		in.read(&word[0], len);
+		ids[i] = dict.wordExists(word) ? (int)dict.getID(word) : -1;
 	}
 
+	vector<Edge> edges;
+	rep(i, 0, numEdges) {
+		int32_t a, b;
+		float weight;
+		in.read((char *)&a, sizeof a);
+		in.read((char *)&b, sizeof b);
+		in.read((char *)&weight, sizeof weight);
+		if (!in || a < 0 || a >= numWords || b < 0 || b >= numWords) {
+			cerr << "Invalid edge file" << endl;
+			return false;
+		}
+		if (ids[a] != -1 && ids[b] != -1) {
+			edges.push_back({(wordID)ids[a], (wordID)ids[b], weight});
+		}
+	}
+	buildAdjacency(edges);
 	return true;
 }
 
+void EdgeListSimilarityEngine::buildAdjacency(const vector<Edge> &edges) {
+	// Store every edge in both directions, remembering the position in the file so that later
+	// duplicates win
+	struct Entry {
+		wordID from, to;
+		int order;
+		float weight;
+		bool operator<(const Entry &other) const {
+			if (from != other.from) return from < other.from;
+			if (to != other.to) return to < other.to;
+			return order < other.order;
+		}
+	};
+	vector<Entry> entries;
+	entries.reserve(2 * edges.size());
+	rep(i, 0, edges.size()) {
+		entries.push_back({edges[i].from, edges[i].to, i, edges[i].weight});
+		entries.push_back({edges[i].to, edges[i].from, i, edges[i].weight});
+	}
+	sort(all(entries));
+
+	int numWords = dict.size();
+	offsets.assign(numWords + 1, 0);
+	neighbors.clear();
+	weights.clear();
+	hasWord.assign((numWords + 63) / 64, 0);
+	rep(i, 0, entries.size()) {
+		const Entry &e = entries[i];
+		if (i + 1 < (int)entries.size() && entries[i + 1].from == e.from &&
+			entries[i + 1].to == e.to) {
+			continue;
+		}
+		offsets[e.from + 1]++;
+		neighbors.push_back(e.to);
+		weights.push_back(e.weight);
+		hasWord[e.from >> 6] |= 1ULL << (e.from & 63);
+	}
+	rep(i, 0, numWords) {
+		offsets[i + 1] += offsets[i];
+	}
+}
+
 bool EdgeListSimilarityEngine::wordExists(const string &word) {
-	return dict.wordExists(word) && hasWord.count(dict.getID(word)) != 0;
+	if (!dict.wordExists(word)) {
+		return false;
+	}
+	int id = dict.getID(word);
+	return id < (int)hasWord.size() * 64 && (hasWord[id >> 6] >> (id & 63) & 1);
+}
+
+float EdgeListSimilarityEngine::edgeWeight(wordID word1, wordID word2) const {
+	if ((int)word1 + 1 >= (int)offsets.size()) {
+		return 0;
+	}
+	auto begin = neighbors.begin() + offsets[word1], end = neighbors.begin() + offsets[word1 + 1];
+	auto it = lower_bound(begin, end, word2);
+	return it != end && *it == word2 ? weights[it - neighbors.begin()] : 0;
 }
 
 float EdgeListSimilarityEngine::commutativeSimilarity(wordID word1, wordID word2) {
-	auto w = edges.find(make_pair(word1, word2));
-	float noise = rand() / (float)RAND_MAX;
-	if (w != edges.end()) return w->second + noise*0.00f;
-	else return 0 + noise*0.00f;
+	return edgeWeight(word1, word2);
 }
 
 float EdgeListSimilarityEngine::similarity(wordID fixedWord, wordID dynWord) {
-	return commutativeSimilarity(fixedWord, dynWord);
+	return edgeWeight(fixedWord, dynWord);
+}
+
+void EdgeListSimilarityEngine::similarityMatrix(const vector<wordID> &fixedWords,
+												const wordID *dynWords, int count, float *out) {
+	int n = (int)fixedWords.size();
+	if (count < 16) {
+		rep(j, 0, count) {
+			rep(i, 0, n) {
+				out[(size_t)j * n + i] = edgeWeight(fixedWords[i], dynWords[j]);
+			}
+		}
+		return;
+	}
+
+	// For larger blocks, spread the row of each fixed word into a dense array indexed by word
+	// ID, so that every lookup is a single load. The array is cleared again afterwards.
+	static thread_local vector<float> dense;
+	int numRows = (int)offsets.size() - 1;
+	if ((int)dense.size() < numRows) {
+		dense.assign(numRows, 0.0f);
+	}
+	rep(i, 0, n) {
+		int w = fixedWords[i];
+		int begin = w < numRows ? offsets[w] : 0, end = w < numRows ? offsets[w + 1] : 0;
+		rep(k, begin, end) {
+			dense[neighbors[k]] = weights[k];
+		}
+		rep(j, 0, count) {
+			out[(size_t)j * n + i] = (int)dynWords[j] < numRows ? dense[dynWords[j]] : 0;
+		}
+		rep(k, begin, end) {
+			dense[neighbors[k]] = 0;
+		}
+	}
 }
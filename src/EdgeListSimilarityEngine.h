@@ -3,21 +3,54 @@
 #include "Dictionary.h"
 #include "SimilarityEngine.h"
 
-#include <map>
-#include <set>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 #include "Utilities.h"
 
+/** Similarity engine over a weighted, undirected graph of words, such as Wikisaurus.
+ *
+ * Edges are read either from a text file (the number of edges, followed by one
+ * "word1 word2 weight" line per edge) or from the binary format written by
+ * "preprocess --edges". Edges between words that are not in the dictionary are dropped.
+ */
 struct EdgeListSimilarityEngine final : SimilarityEngine {
    private:
-   	std::map<std::pair<wordID,wordID>,float> edges;
-   	std::set<wordID> hasWord;
+	// Adjacency in compressed sparse row form: the neighbours of word w are
+	// neighbors[offsets[w]] to neighbors[offsets[w+1]-1], sorted by ID, with the edge weights at
+	// the same positions in weights. Words added to the dictionary after loading have no row.
+	std::vector<int> offsets;
+	std::vector<wordID> neighbors;
+	std::vector<float> weights;
+
+	// Bitmap of the words that have at least one edge
+	std::vector<uint64_t> hasWord;
 
 	Dictionary &dict;
 
+	struct Edge {
+		wordID from, to;
+		float weight;
+	};
+
+	/** Builds the adjacency from edges given in file order. If an edge occurs several times, the
+	 * last weight is used. */
+	void buildAdjacency(const std::vector<Edge> &edges);
+
+	bool loadText(std::istream &in);
+	bool loadBinary(std::istream &in);
+
+	/** Weight of the edge between two words, or 0 if there is none. Binary search in the row of
+	 * the first word. */
+	float edgeWeight(wordID word1, wordID word2) const;
+
    public:
+	// Binary edge files start with these two ints, followed by the number of words and edges,
+	// the words (an int length followed by the characters) and the edges (two int indices into
+	// the words and a float weight).
+	static const int32_t FILE_MAGIC = 0x45474445;  // "EDGE"
+	static const int32_t FILE_VERSION = 1;
 
 	EdgeListSimilarityEngine(Dictionary &dict) : dict(dict) {}
 
@@ -28,6 +61,8 @@ struct EdgeListSimilarityEngine final : SimilarityEngine {
 	bool load(const std::string &fileName, bool verbose);
 
 	float similarity(wordID fixedWord, wordID dynWord);
+	void similarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords, int count,
+						  float *out);
 	float commutativeSimilarity(wordID word1, wordID word2);
 
 	/** True if the word2vec model includes a vector for the specified word */
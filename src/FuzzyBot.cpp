@@ -1,9 +1,14 @@
 #include "FuzzyBot.h"
+#include "Kernels.h"
+#include "TopK.h"
 #include <algorithm>
 #include <cassert>
+#include <functional>
 #include <iostream>
-#include <map>
-#include <queue>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
 
 #define rep(i, a, b) for (int i = (a); i < int(b); ++i)
 #define trav(x, v) for (auto &x : v)
@@ -103,17 +108,44 @@ void FuzzyBot::setDifficulty(Difficulty difficulty) {
 	}
 }
 
+vector<wordID> FuzzyBot::scoringWords() const {
+	vector<wordID> ret;
+	ret.reserve(boardWords.size() + oldClues.size());
+	trav(w, boardWords) ret.push_back(w.id);
+	trav(clue, oldClues) ret.push_back(clue);
+	return ret;
+}
+
 pair<float, vector<wordID>> FuzzyBot::getWordScore(wordID word, vector<ValuationItem> *valuation,
 											  bool doInflate) {
+	vector<wordID> fixedWords = scoringWords();
+	vector<float> similarities(fixedWords.size());
+	engine.exactSimilarityMatrix(fixedWords, &word, 1, similarities.data());
+	return getWordScore(word, similarities.data(), valuation, doInflate);
+}
+
+pair<float, vector<wordID>> FuzzyBot::getWordScore(wordID word, const float *similarities,
+											  vector<ValuationItem> *valuation, bool doInflate) {
+	pair<float, vector<wordID>> res =
+		getUnweightedWordScore(similarities, valuation, doInflate);
+	bool blocked;
+	float factor = wordFactor(word, &blocked);
+	res.first = blocked ? -numeric_limits<float>::infinity() : res.first * factor;
+	return res;
+}
+
+pair<float, vector<wordID>> FuzzyBot::getUnweightedWordScore(const float *similarities,
+															 vector<ValuationItem> *valuation,
+															 bool doInflate) {
 	typedef pair<float, BoardWord *> Pa;
-	static vector<Pa> v;
+	static thread_local vector<Pa> v;
 	int myWordsLeft = 0, opponentWordsLeft = 0;
 	v.clear();
 
 	// Iterate through all words and check how similar the word is to every word on the board.
 	// Add some bonuses to account for the colors of the words.
 	rep(i, 0, boardWords.size()) {
-		float sim = engine.similarity(boardWords[i].id, word);
+		float sim = similarities[i];
 		if (boardWords[i].type == CardType::CIVILIAN) {
 			if (doInflate) {
 				sim += marginCivilians;
@@ -144,6 +176,34 @@ pair<float, vector<wordID>> FuzzyBot::getWordScore(wordID word, vector<Valuation
 		}
 	}
 
+	// Compute all logistic terms in one pass: those of the board words in sorted order, those of
+	// the old clues, and for each word the margin to the next opponent word or assassin below it
+	// (if any), which is used for our words
+	static thread_local vector<float> terms;
+	static thread_local vector<int> nextBad;
+	int numWords = (int)v.size(), numOldClues = (int)oldClues.size();
+	int marginStart = numWords + numOldClues;
+	terms.resize(marginStart + numWords);
+	nextBad.resize(numWords);
+	rep(i, 0, numWords) {
+		terms[i] = (-v[i].first - fuzzyOffset) * fuzzyExponent;
+	}
+	rep(i, 0, numOldClues) {
+		float sim = similarities[boardWords.size() + i];
+		sim += marginOldClue;
+		terms[numWords + i] = (sim - fuzzyOffset) * fuzzyExponent;
+	}
+	int bad = -1;
+	for (int i = numWords - 1; i >= 0; i--) {
+		nextBad[i] = bad;
+		terms[marginStart + i] = bad == -1 ? 0 : (-v[i].first - (-v[bad].first)) * fuzzyExponent;
+		CardType type = v[i].second->type;
+		if (type == CardType::ASSASSIN || type == CardType::OPPONENT) {
+			bad = i;
+		}
+	}
+	sigmoidArray(terms.data(), terms.data(), (int)terms.size());
+
 	// Compute a fuzzy score
 	float baseScore = 0;
 	rep(i, 0, v.size()) {
@@ -164,20 +224,18 @@ pair<float, vector<wordID>> FuzzyBot::getWordScore(wordID word, vector<Valuation
 			default:
 				abort();
 		}
-		float contribution = weight * sigmoid((-v[i].first - fuzzyOffset) * fuzzyExponent);
+		float contribution = weight * terms[i];
 		baseScore += contribution;
 	}
 
 	// Avoid FuzzyBot::clues that are similar to clues the bot has given earlier
-	for (auto oldClue : oldClues) {
-		float sim = engine.similarity(oldClue, word);
-		sim += marginOldClue;
-		float contribution = fuzzyWeightOldClue * sigmoid((sim - fuzzyOffset) * fuzzyExponent);
+	rep(i, 0, oldClues.size()) {
+		float contribution = fuzzyWeightOldClue * terms[numWords + i];
 		baseScore += contribution;
 	}
 
 	int bestCount = 1;
-	float curScore = 0, bestScore = baseScore - 10, lastGood = 0;
+	float curScore = 0, bestScore = baseScore - 10;
 	int curCount = 0;
 	float mult = 1;
 
@@ -196,8 +254,7 @@ pair<float, vector<wordID>> FuzzyBot::getWordScore(wordID word, vector<Valuation
 			continue;
 		}
 		if (type == CardType::MINE) {
-			lastGood = -v[i].first;
-			curScore += mult * sigmoid((-v[i].first - fuzzyOffset) * fuzzyExponent);
+			curScore += mult * terms[i];
 			++curCount;
 		}
 		if (type == CardType::CIVILIAN) {
@@ -206,13 +263,8 @@ pair<float, vector<wordID>> FuzzyBot::getWordScore(wordID word, vector<Valuation
 			continue;
 		}
 		float tmpScore = -1;
-		rep(j, i + 1, v.size()) {
-			CardType type2 = v[j].second->type;
-			if (type2 == CardType::ASSASSIN || type2 == CardType::OPPONENT) {
-				tmpScore =
-					mult * marginWeight * sigmoid((lastGood - (-v[j].first)) * fuzzyExponent);
-				break;
-			}
+		if (nextBad[i] != -1) {
+			tmpScore = mult * marginWeight * terms[marginStart + i];
 		}
 		tmpScore += baseScore + curScore;
 		if (curCount == 1) {
@@ -241,137 +293,543 @@ pair<float, vector<wordID>> FuzzyBot::getWordScore(wordID word, vector<Valuation
 		}
 	}
 
+	return make_pair(bestScore, targetWords);
+}
+
+float FuzzyBot::wordFactor(wordID word, bool *blocked) const {
+	float factor = 1;
 	int popularity = dict.getPopularity(word);
 	if (popularity < commonWordLimit)
-		bestScore *= commonWordWeight;
+		factor *= commonWordWeight;
 	else if (popularity > rareWordLimit)
-		bestScore *= rareWordWeight;
+		factor *= rareWordWeight;
 
+	*blocked = false;
 	bool isInappropriate = inappropriateEngine.isInappropriate(word);
 	switch (inappropriateMode) {
 		case BlockInappropriate:
-			if (isInappropriate) {
-				bestScore = -numeric_limits<float>::infinity();
-			}
+			*blocked = isInappropriate;
 			break;
 		case BoostInappropriate:
 			if (isInappropriate) {
-				bestScore *= inappropriateBoost;
+				factor *= inappropriateBoost;
 			}
 			break;
 		case AllowInappropriate:
 			break;
 	}
+	return factor;
+}
 
-	return make_pair(bestScore, targetWords);
+void FuzzyBot::updateWordFactors(int count) {
+	count = min(count, dict.size());
+	WordFactorSettings settings(commonWordLimit, rareWordLimit, commonWordWeight, rareWordWeight,
+								inappropriateMode, inappropriateBoost);
+	if ((int)wordFactors.size() == count && settings == wordFactorSettings) {
+		return;
+	}
+	wordFactorSettings = settings;
+	wordFactors.resize(count);
+	blockedWords.resize(count);
+	rep(i, 0, count) {
+		bool blocked;
+		wordFactors[i] = wordFactor(wordID(i), &blocked);
+		blockedWords[i] = blocked;
+	}
 }
 
-vector<Bot::Result> FuzzyBot::findBestWords(int count) {
-	vector<wordID> candidates = dict.getCommonWords(vocabularySize);
-	priority_queue<pair<pair<float, int>, wordID>> pq;
-	map<int, int> bitRepresentation;
-	int myWordsFound = 0;
-	rep(i, 0, boardWords.size()) {
-		if (boardWords[i].type == CardType::MINE &&
-			!hasInfoAbout.count(dict.getWord(boardWords[i].id))) {
-			bitRepresentation[boardWords[i].id] = (1 << myWordsFound);
-			++myWordsFound;
-		} else {
-			bitRepresentation[boardWords[i].id] = 0;
-		}
-	}
-
-	bool usePlanning = false;
-	vector<int> minMovesNeeded;
-	vector<float> bestScore;
-	vector<float> bestClueScore;
-	vector<wordID> bestWord;
-	vector<int> bestParent;
-	if (usePlanning) {
-		minMovesNeeded = vector<int>((1 << myWordsFound), 1000);
-		bestScore = vector<float>((1 << myWordsFound), -1000);
-		bestClueScore = vector<float>((1 << myWordsFound), -1000);
-		bestWord = vector<wordID>(1 << myWordsFound);
-		bestParent = vector<int>(1 << myWordsFound);
-		minMovesNeeded[0] = 0;
-		bestScore[0] = 0;
-	}
-
-	for (wordID candidate : candidates) {
-		pair<float, vector<wordID>> res = getWordScore(candidate, nullptr, true);
-		pq.push({{res.first, -((int)res.second.size())}, candidate});
-		if (res.second.size() > 0 && usePlanning) {
-			int bits = 0;
-			for (int matchedWord : res.second) {
-				bits |= bitRepresentation[matchedWord];
+bool FuzzyBot::canBoundScores() const {
+	bool ok = weightOpponent <= 0 && weightCivilian <= 0 && multiplierAfterBadWord >= 0 &&
+			  multiplierAfterBadWord <= 1 && commonWordWeight >= 0 && rareWordWeight >= 0 &&
+			  inappropriateBoost >= 0;
+	rep(i, 0, 4) {
+		ok = ok && desperationFactor[i] >= 0;
+	}
+	return ok;
+}
+
+float FuzzyBot::scoreUpperBound(wordID word, const float *similarities) const {
+	// The base score does not depend on the order of the board words, so it is computed exactly
+	// (up to rounding), as in getWordScore. Our similarities are never inflated.
+	static thread_local vector<float> sims, weights, terms;
+	int n = (int)boardWords.size();
+	sims.resize(n);
+	weights.resize(n);
+	terms.resize(n + oldClues.size());
+	int opponentWordsLeft = 0;
+	rep(i, 0, n) {
+		float sim = similarities[i], weight;
+		switch (boardWords[i].type) {
+			case CardType::MINE:
+				weight = fuzzyWeightMy;
+				break;
+			case CardType::OPPONENT:
+				sim += marginOpponentWords;
+				weight = fuzzyWeightOpponent;
+				opponentWordsLeft++;
+				break;
+			case CardType::CIVILIAN:
+				sim += marginCivilians;
+				weight = fuzzyWeightCivilian;
+				break;
+			default:
+				sim += marginAssassins;
+				weight = fuzzyWeightAssassin;
+				break;
+		}
+		sims[i] = sim;
+		weights[i] = weight;
+		terms[i] = (sim - fuzzyOffset) * fuzzyExponent;
+	}
+	rep(i, 0, oldClues.size()) {
+		float sim = similarities[n + i] + marginOldClue;
+		terms[n + i] = (sim - fuzzyOffset) * fuzzyExponent;
+	}
+	sigmoidArray(terms.data(), terms.data(), (int)terms.size());
+	float baseScore = 0;
+	rep(i, 0, n) {
+		baseScore += weights[i] * terms[i];
+	}
+	rep(i, 0, oldClues.size()) {
+		baseScore += fuzzyWeightOldClue * terms[n + i];
+	}
+
+	// The score is the best of baseScore - 10 and the scores after each of our words that the
+	// guessing reaches. Such a word has a similarity of at least minSimilarity and no assassin
+	// above it. The running score after it adds at most the terms of our words that are not
+	// below it, and exactly weightOpponent for each opponent word above it; civilians only
+	// subtract. The margin term is at most marginWeight, and the penalty for a single word
+	// applies if no other of our words can come first. Ties in the order are resolved in the
+	// direction that gives the larger bound.
+	float bound = baseScore - 10;
+	rep(m, 0, n) {
+		if (boardWords[m].type != CardType::MINE || sims[m] < minSimilarity) {
+			continue;
+		}
+		float running = 0;
+		int count = 0;
+		bool reachable = true;
+		rep(j, 0, n) {
+			CardType type = boardWords[j].type;
+			if (type == CardType::MINE && sims[j] >= sims[m]) {
+				running += terms[j];
+				count++;
+			} else if (type == CardType::OPPONENT && sims[j] > sims[m]) {
+				running += weightOpponent;
+			} else if (type == CardType::ASSASSIN && sims[j] > sims[m]) {
+				reachable = false;
 			}
-			float newScore = res.first - valueOfOneTurn;
-			if (bits && newScore > bestScore[bits] && !forbiddenWord(dict.getWord(candidate))) {
-				minMovesNeeded[bits] = 1;
-				bestScore[bits] = newScore;
-				bestWord[bits] = candidate;
-				bestParent[bits] = 0;
+		}
+		if (reachable) {
+			float penalty = count == 1 ? singleWordPenalty : max(singleWordPenalty, 0.0f);
+			bound = max(bound, baseScore + running + max(marginWeight, 0.0f) + penalty);
+		}
+	}
+
+	// The multipliers can make negative scores larger, so both outcomes are bounded; x and
+	// x * factor are both increasing in x.
+	auto multiply = [](float x, float factor) { return max(x, x * factor); };
+	if (opponentWordsLeft <= 3) {
+		bound = multiply(bound, desperationFactor[opponentWordsLeft]);
+	}
+	bool blocked;
+	float factor;
+	if ((int)word < (int)wordFactors.size()) {
+		factor = wordFactors[word];
+		blocked = blockedWords[word];
+	} else {
+		factor = wordFactor(word, &blocked);
+	}
+	if (blocked) {
+		return -numeric_limits<float>::infinity();
+	}
+	bound = multiply(bound, factor);
+
+	// Leave room for the rounding errors of summing the score in a different order
+	return bound + 1e-4f * (1 + abs(bound));
+}
+
+namespace {
+
+/** Scores of a block of candidates before they are multiplied by their word factors */
+struct BlockScores {
+	vector<float> score;
+	vector<int> targetCount, targetBits;
+	vector<char> scored;
+
+	void resize(int size) {
+		score.resize(size);
+		targetCount.resize(size);
+		targetBits.resize(size);
+		scored.resize(size);
+	}
+};
+
+/** A scan of the candidate clues of a FuzzyBot, as made by FuzzyBot::findBestWords. The
+ * candidates are scored in blocks, given to #scanBlock by any number of threads, and #finish picks
+ * the clues. The similarities of a block may come from anywhere, which lets
+ * FuzzyBot::findBestWordsForBoards compute them once for many bots. */
+struct CandidateScan {
+	typedef pair<pair<float, int>, wordID> Entry;
+	// The best clue that targets a set of planning words, as (score, index into candidates)
+	typedef pair<float, int> PlanEntry;
+
+	FuzzyBot &bot;
+	vector<wordID> candidates;
+	vector<wordID> fixedWords;
+	int numBlocks, threads;
+
+	// The planner covers the team's words that have not been clued yet. Each of them gets a bit,
+	// in the order of the board.
+	vector<wordID> planningWords;
+	bool planning;
+	int numMasks;
+	const PlanEntry noClue{0, -1};
+
+	// Each thread keeps the best candidates it has seen that are not forbidden in a TopK.
+	// Candidates are ordered by score, then by fewer target words, then by ID, so the merged
+	// result does not depend on how the blocks were distributed.
+	int keep;
+	vector<TopK<Entry>> threadBest;
+
+	// For every set of planning words, the best clue of each thread that targets exactly that
+	// set. The index is -1 while there is none.
+	vector<vector<PlanEntry>> clueTables;
+
+	// A candidate is only scored if its upper bound can beat the worst candidate kept so far.
+	// Planning needs the scores of all candidates.
+	bool prune;
+	vector<int> pruned;
+	vector<BlockScores> blockScores;
+
+	/** Prepares a scan for up to count clues on numThreads threads (see #resolveThreadCount), at
+	 * most one per block */
+	CandidateScan(FuzzyBot &bot, int count, int numThreads);
+
+	/** Scores the candidates of a block, given their similarities to #fixedWords in the layout of
+	 * SimilarityEngine::similarityMatrix */
+	void scanBlock(int block, const float *similarities, int thread);
+
+	vector<Bot::Result> finish(int count);
+};
+
+CandidateScan::CandidateScan(FuzzyBot &bot, int count, int numThreads)
+	: bot(bot), candidates(bot.dict.getCommonWords(bot.vocabularySize)) {
+	fixedWords = bot.scoringWords();
+	numBlocks = ((int)candidates.size() + Bot::SCAN_BLOCK_SIZE - 1) / Bot::SCAN_BLOCK_SIZE;
+	threads = max(1, min(resolveThreadCount(numThreads), numBlocks));
+
+	rep(i, 0, bot.boardWords.size()) {
+		if (bot.boardWords[i].type == Bot::CardType::MINE &&
+			!bot.hasInfoAbout.count(bot.dict.getWord(bot.boardWords[i].id))) {
+			planningWords.push_back(bot.boardWords[i].id);
+		}
+	}
+	planning = bot.usePlanning && !planningWords.empty() &&
+			   (int)planningWords.size() <= FuzzyBot::MAX_PLANNING_WORDS;
+	numMasks = planning ? 1 << planningWords.size() : 0;
+
+	keep = max(count, bot.rerankCount);
+	threadBest.assign(threads, TopK<Entry>(keep));
+	clueTables.assign(threads, vector<PlanEntry>(numMasks, noClue));
+	prune = !planning && bot.canBoundScores();
+	pruned.assign(threads, 0);
+	blockScores.resize(threads);
+
+	bot.markForbiddenWords((int)candidates.size());
+	bot.updateWordFactors((int)candidates.size());
+}
+
+void CandidateScan::scanBlock(int block, const float *similarities, int thread) {
+	TopK<Entry> &kept = threadBest[thread];
+	BlockScores &scores = blockScores[thread];
+	int start = block * Bot::SCAN_BLOCK_SIZE;
+	int blockSize = min((int)candidates.size() - start, Bot::SCAN_BLOCK_SIZE);
+	scores.resize(blockSize);
+
+	// Score the candidates of the block without their word factors. Candidates are word IDs
+	// from 0, so the factors of the block are consecutive.
+	rep(offset, 0, blockSize) {
+		wordID candidate = candidates[start + offset];
+		scores.scored[offset] = false;
+		scores.score[offset] = 0;
+		if (bot.isForbidden(candidate) || bot.blockedWords[candidate]) {
+			continue;
+		}
+		const float *candidateSimilarities = &similarities[(size_t)offset * fixedWords.size()];
+		if (prune && kept.full() &&
+			bot.scoreUpperBound(candidate, candidateSimilarities) < kept.worst().first.first) {
+			pruned[thread]++;
+			continue;
+		}
+		pair<float, vector<wordID>> res =
+			bot.getUnweightedWordScore(candidateSimilarities, nullptr, true);
+		int bits = 0;
+		if (planning) {
+			for (wordID matchedWord : res.second) {
+				rep(bit, 0, planningWords.size()) {
+					if (planningWords[bit] == matchedWord) {
+						bits |= 1 << bit;
+					}
+				}
 			}
 		}
+		scores.scored[offset] = true;
+		scores.score[offset] = res.first;
+		scores.targetCount[offset] = (int)res.second.size();
+		scores.targetBits[offset] = bits;
+	}
+
+	const float *factors = &bot.wordFactors[candidates[start]];
+	rep(offset, 0, blockSize) {
+		scores.score[offset] *= factors[offset];
+	}
+
+	rep(offset, 0, blockSize) {
+		if (!scores.scored[offset]) {
+			continue;
+		}
+		float score = scores.score[offset];
+		int bits = scores.targetBits[offset];
+		if (planning) {
+			PlanEntry &tableEntry = clueTables[thread][bits];
+			if (bits && (tableEntry.second == -1 || score > tableEntry.first)) {
+				tableEntry = PlanEntry(score, start + offset);
+			}
+		}
+		kept.push(Entry{{score, -scores.targetCount[offset]}, candidates[start + offset]});
+	}
+}
+
+vector<Bot::Result> CandidateScan::finish(int count) {
+	Dictionary &dict = bot.dict;
+	bot.lastScanStats.candidates = (int)candidates.size();
+	bot.lastScanStats.pruned = 0;
+	trav(threadPruned, pruned) {
+		bot.lastScanStats.pruned += threadPruned;
+	}
+
+	vector<Entry> best;
+	trav(kept, threadBest) {
+		best.insert(best.end(), all(kept.values()));
+	}
+	sort(all(best), greater<Entry>());
+
+	if (bot.rerankCount > 0) {
+		// Replace the approximate scores of the best candidates by exact ones
+		int shortlistSize = min(bot.rerankCount, (int)best.size());
+		vector<wordID> shortlist;
+		rep(i, 0, shortlistSize) {
+			shortlist.push_back(best[i].second);
+		}
+		vector<float> exact(shortlist.size() * fixedWords.size());
+		bot.engine.exactSimilarityMatrix(fixedWords, shortlist.data(), (int)shortlist.size(),
+										 exact.data());
+		rep(i, 0, shortlistSize) {
+			pair<float, vector<wordID>> res =
+				bot.getWordScore(shortlist[i], &exact[i * fixedWords.size()], nullptr, true);
+			best[i] = Entry{{res.first, -((int)res.second.size())}, shortlist[i]};
+		}
+		sort(all(best), greater<Entry>());
 	}
 
 	vector<Bot::Result> res;
 
-	if (usePlanning) {
-		// Make a plan so that every word is covered by a clue in as few moves as possible
+	if (planning) {
+		// Merge the tables of the threads. Equal scores go to the earliest candidate, as if the
+		// candidates had been scanned in order.
+		vector<PlanEntry> clues(numMasks, noClue);
+		trav(table, clueTables) {
+			rep(mask, 0, numMasks) {
+				PlanEntry &entry = clues[mask];
+				if (table[mask].second != -1 &&
+					(entry.second == -1 || table[mask].first > entry.first ||
+					 (table[mask].first == entry.first && table[mask].second < entry.second))) {
+					entry = table[mask];
+				}
+			}
+		}
 
-		for (int i = 0; i < (1 << myWordsFound); ++i) {
-			if (minMovesNeeded[i] != 1)
-				continue;
-			for (int j = 0; j < (1 << myWordsFound); ++j) {
-				int k = (i | j);
-				if (k == i || k == j)
+		// A clue that targets a set of words can be used to cover any subset of it, if the other
+		// words are covered by other clues of the plan. Every word that is covered twice costs
+		// overlapPenalty. Every clue costs a turn. Supersets are handled before their subsets, and
+		// coverClue is -1 for sets that no clue covers.
+		vector<float> coverScore(numMasks);
+		vector<int> coverClue(numMasks);
+		for (int mask = numMasks - 1; mask > 0; mask--) {
+			coverScore[mask] = clues[mask].first - bot.valueOfOneTurn;
+			coverClue[mask] = clues[mask].second;
+			rep(bit, 0, planningWords.size()) {
+				int superset = mask | (1 << bit);
+				if (superset == mask || coverClue[superset] == -1) {
 					continue;
-				float newScore = bestScore[i] + bestScore[j];
-				newScore -= __builtin_popcount(i & j) * overlapPenalty;
-				if (newScore > bestScore[k]) {
-					minMovesNeeded[k] = minMovesNeeded[j] + 1;
-					bestScore[k] = newScore;
-					bestClueScore[k] = bestScore[i];
-					bestParent[k] = j;
-					bestWord[k] = bestWord[i];
 				}
+				float score = coverScore[superset] - bot.overlapPenalty;
+				if (coverClue[mask] == -1 || score > coverScore[mask]) {
+					coverScore[mask] = score;
+					coverClue[mask] = coverClue[superset];
+				}
+			}
+		}
+
+		// Split every set of words into the part with its lowest word that one clue covers and
+		// the rest, which takes O(3^n) time for n words. firstPart is 0 for sets that cannot be
+		// covered.
+		vector<float> planScore(numMasks, 0);
+		vector<int> firstPart(numMasks, 0);
+		rep(mask, 1, numMasks) {
+			int lowest = mask & -mask;
+			int rest = mask ^ lowest;
+			for (int sub = rest;; sub = (sub - 1) & rest) {
+				int part = sub | lowest;
+				bool possible = coverClue[part] != -1 && (sub == rest || firstPart[mask ^ part]);
+				float score = coverScore[part] + planScore[mask ^ part];
+				if (possible && (!firstPart[mask] || score > planScore[mask])) {
+					planScore[mask] = score;
+					firstPart[mask] = part;
+				}
+				if (sub == 0) {
+					break;
+				}
+			}
+		}
+
+		// Some words may not be the target of any clue. Plan for as many words as possible.
+		int target = 0;
+		rep(mask, 1, numMasks) {
+			int words = __builtin_popcount(mask), targetWords = __builtin_popcount(target);
+			if (firstPart[mask] &&
+				(words > targetWords || (words == targetWords && planScore[mask] > planScore[target]))) {
+				target = mask;
 			}
 		}
 
-		// Reconstruct the best sequence of words
-		int bits = (1 << myWordsFound) - 1;
-		while (bits != 0) {
-			cerr << bits << endl;
-			wordID word = bestWord[bits];
-			bits = bestParent[bits];
-			vector<ValuationItem> val;
-			auto wordScore = getWordScore(word, &val, false);
+		// Reconstruct the clues of the plan. One clue may cover several parts.
+		vector<int> planned;
+		for (int mask = target; mask != 0; mask ^= firstPart[mask]) {
+			int index = coverClue[firstPart[mask]];
+			if (find(all(planned), index) == planned.end()) {
+				planned.push_back(index);
+			}
+		}
+		trav(index, planned) {
+			wordID word = candidates[index];
+			vector<Bot::ValuationItem> val;
+			auto wordScore = bot.getWordScore(word, &val, false);
 			float score = wordScore.first;
 			int number = (int)wordScore.second.size();
-			res.push_back(Bot::Result{dict.getWord(word), number, score, val});
+			res.push_back(Bot::Result{string(dict.getWord(word)), number, score, val});
 		}
 		sort(all(res));
 		return res;
 	}
 
-	// Extract the top 'count' words that are not forbidden by the rules
-	while ((int)res.size() < count && !pq.empty()) {
-		auto pa = pq.top();
-		pq.pop();
-		if (!forbiddenWord(dict.getWord(pa.second))) {
-			float score = pa.first.first;
-			int number = -pa.first.second;
-			wordID word = pa.second;
-			vector<ValuationItem> val;
-			getWordScore(word, &val, false);
-			res.push_back(Bot::Result{dict.getWord(word), number, score, val});
-		}
+	// Return the top 'count' words, forbidden words were skipped while scanning
+	rep(i, 0, min(count, (int)best.size())) {
+		float score = best[i].first.first;
+		int number = -best[i].first.second;
+		wordID word = best[i].second;
+		vector<Bot::ValuationItem> val;
+		bot.getWordScore(word, &val, false);
+		res.push_back(Bot::Result{string(dict.getWord(word)), number, score, val});
 	}
 
 	return res;
 }
 
+}  // namespace
+
+vector<Bot::Result> FuzzyBot::findBestWords(int count) {
+	CandidateScan scan(*this, count, numThreads);
+	similarityCache.update(engine, scan.candidates, scan.fixedWords, numThreads);
+	vector<vector<float>> similarities(scan.threads);
+	parallelFor(scan.numBlocks, scan.threads, [&](int block, int thread) {
+		vector<float> &blockSimilarities = similarities[thread];
+		int start = block * SCAN_BLOCK_SIZE;
+		int blockSize = min((int)scan.candidates.size() - start, SCAN_BLOCK_SIZE);
+		blockSimilarities.resize((size_t)blockSize * scan.fixedWords.size());
+		similarityCache.gather(start, blockSize, blockSimilarities.data());
+		scan.scanBlock(block, blockSimilarities.data(), thread);
+	});
+	return scan.finish(count);
+}
+
+vector<vector<Bot::Result>> FuzzyBot::findBestWordsForBoards(const vector<FuzzyBot *> &bots,
+															   int count, int numThreads) {
+	vector<vector<Result>> results(bots.size());
+	if (bots.empty()) {
+		return results;
+	}
+	SimilarityEngine &engine = bots[0]->engine;
+	vector<unique_ptr<CandidateScan>> scans;
+	trav(bot, bots) {
+		scans.emplace_back(new CandidateScan(*bot, count, numThreads));
+		if (&bot->engine != &engine || scans.back()->candidates != scans[0]->candidates) {
+			throw invalid_argument("The bots of a batch must share their engine and candidates");
+		}
+	}
+	const CandidateScan &first = *scans[0];
+
+	// The words that any of the bots scores against, and where each bot finds its own
+	vector<wordID> words;
+	unordered_map<wordID, int> wordIndex;
+	vector<vector<int>> columns(bots.size());
+	rep(b, 0, bots.size()) {
+		trav(word, scans[b]->fixedWords) {
+			if (!wordIndex.count(word)) {
+				wordIndex[word] = (int)words.size();
+				words.push_back(word);
+			}
+			columns[b].push_back(wordIndex[word]);
+		}
+	}
+
+	// Compute the similarities of each block of candidates to all words, in chunks of words that
+	// fit in the cache next to the candidate vectors, then let every bot score the block
+	int numChunks = ((int)words.size() + BOARD_BATCH_CHUNK_SIZE - 1) / BOARD_BATCH_CHUNK_SIZE;
+	vector<vector<wordID>> chunks(numChunks);
+	rep(i, 0, words.size()) {
+		chunks[i / BOARD_BATCH_CHUNK_SIZE].push_back(words[i]);
+	}
+	struct ThreadBuffers {
+		vector<float> chunk, all, board;
+	};
+	vector<ThreadBuffers> buffers(first.threads);
+	parallelFor(first.numBlocks, first.threads, [&](int block, int thread) {
+		ThreadBuffers &buffer = buffers[thread];
+		int start = block * SCAN_BLOCK_SIZE;
+		int blockSize = min((int)first.candidates.size() - start, SCAN_BLOCK_SIZE);
+		const wordID *blockCandidates = &first.candidates[start];
+		buffer.all.resize((size_t)blockSize * words.size());
+		rep(c, 0, numChunks) {
+			int chunkSize = (int)chunks[c].size();
+			int offset = c * BOARD_BATCH_CHUNK_SIZE;
+			buffer.chunk.resize((size_t)blockSize * chunkSize);
+			engine.similarityMatrix(chunks[c], blockCandidates, blockSize, buffer.chunk.data());
+			rep(j, 0, blockSize) {
+				copy_n(&buffer.chunk[(size_t)j * chunkSize], chunkSize,
+					   &buffer.all[(size_t)j * words.size() + offset]);
+			}
+		}
+		rep(b, 0, bots.size()) {
+			int n = (int)columns[b].size();
+			buffer.board.resize((size_t)blockSize * n);
+			rep(j, 0, blockSize) {
+				const float *row = &buffer.all[(size_t)j * words.size()];
+				rep(i, 0, n) {
+					buffer.board[(size_t)j * n + i] = row[columns[b][i]];
+				}
+			}
+			scans[b]->scanBlock(block, buffer.board.data(), thread);
+		}
+	});
+
+	rep(b, 0, bots.size()) {
+		results[b] = scans[b]->finish(count);
+	}
+	return results;
+}
+
 void FuzzyBot::setHasInfo(string word) {
 	hasInfoAbout.insert(word);
 }
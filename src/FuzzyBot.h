@@ -8,6 +8,7 @@
 
 #include <set>
 #include <string>
+#include <tuple>
 #include <vector>
 
 struct FuzzyBot : Bot {
@@ -63,6 +64,7 @@ struct FuzzyBot : Bot {
 	// An approximation of the number of correct words we expect each turn
 	float valueOfOneTurn;
 
+	// Penalty for every word that a plan covers with more than one clue
 	float overlapPenalty;
 
 	// Apply penalties to clues with small numbers based on the number of
@@ -72,8 +74,33 @@ struct FuzzyBot : Bot {
 	// Apply a penalty to words that only cover a single word
 	float singleWordPenalty;
 
+	// If positive, this many of the best candidates found by the scan are scored again from
+	// exact similarities before the clues are picked. Useful when the engine scans quantized
+	// vectors.
+	int rerankCount = 0;
+
+	// Instead of the best clues for this turn, return a plan of clues that together cover all of
+	// the team's words that have not been clued yet, in order of decreasing score. The plan
+	// maximizes the total score minus valueOfOneTurn for every clue and overlapPenalty for every
+	// word that is covered twice.
+	bool usePlanning = false;
+
+	// Plans are only made for at most this many words, with more the best clues are returned
+	static const int MAX_PLANNING_WORDS = 16;
+
+	// Number of words whose similarities to a block of candidates are computed in a single
+	// SimilarityEngine::similarityMatrix call by #findBestWordsForBoards
+	static const int BOARD_BATCH_CHUNK_SIZE = 64;
+
+	// #wordFactor of the first words (the candidates), and whether they are blocked, computed by
+	// #updateWordFactors for the settings in wordFactorSettings
+	typedef std::tuple<int, int, float, float, InappropriateMode, float> WordFactorSettings;
+	std::vector<float> wordFactors;
+	std::vector<char> blockedWords;
+	WordFactorSettings wordFactorSettings;
+
 	// A set of strings for which the bot has already provided clues
-	std::set<std::string> hasInfoAbout;
+	std::set<std::string, std::less<>> hasInfoAbout;
 
 	// A list of all clues that have already been given to the team
 	std::vector<wordID> oldClues;
@@ -85,12 +112,53 @@ struct FuzzyBot : Bot {
 
 	void setDifficulty(Difficulty difficulty);
 
+	/** The words that a candidate is compared against when it is scored: all board words, in
+	 * order, followed by all old clues */
+	std::vector<wordID> scoringWords() const;
+
+	/** Scores a single word, using exact similarities */
 	std::pair<float, std::vector<wordID>> getWordScore(wordID word,
 													   std::vector<ValuationItem> *valuation,
 													   bool doInflate);
 
+	/** Like the above, but with the similarities between the scoring words and the word
+	 * precomputed, in the order given by #scoringWords */
+	std::pair<float, std::vector<wordID>> getWordScore(wordID word, const float *similarities,
+													   std::vector<ValuationItem> *valuation,
+													   bool doInflate);
+
+	/** Like the above, but without the factor of #wordFactor, which is the only part of the
+	 * score that depends on the word itself */
+	std::pair<float, std::vector<wordID>> getUnweightedWordScore(
+		const float *similarities, std::vector<ValuationItem> *valuation, bool doInflate);
+
+	/** The factor that the score of a word is multiplied with, for how common the word is and, in
+	 * BoostInappropriate mode, for being inappropriate. Sets blocked for inappropriate words in
+	 * BlockInappropriate mode, which get a score of minus infinity instead. */
+	float wordFactor(wordID word, bool *blocked) const;
+
+	/** Fills wordFactors and blockedWords for the first count words, unless they are up to date */
+	void updateWordFactors(int count);
+
+	/** True if the weights have the signs that #scoreUpperBound relies on, which the weights of
+	 * all difficulties have */
+	bool canBoundScores() const;
+
+	/** An upper bound on the score that #getWordScore gives a word when inflating, from the same
+	 * similarities. Cheaper than the score itself, as it does not need the board words in order
+	 * of similarity. Requires #canBoundScores, and takes the word factors from #updateWordFactors
+	 * if it covers the word. */
+	float scoreUpperBound(wordID word, const float *similarities) const;
+
 	std::vector<Result> findBestWords(int count = 20);
 
+	/** The results of #findBestWords for each of the bots, which must share their engine and
+	 * vocabulary. The candidates are read once for all boards: each block of them is compared
+	 * against the board words and old clues of every bot while it is in the cache, and then
+	 * scored by each bot. Does not use or update the similarity caches of the bots. */
+	static std::vector<std::vector<Result>> findBestWordsForBoards(
+		const std::vector<FuzzyBot *> &bots, int count, int numThreads);
+
 	void setHasInfo(std::string word);
 
 	void addOldClue(std::string clue);
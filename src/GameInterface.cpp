@@ -83,6 +83,7 @@ void GameInterface::commandHelp() {
 	cout << "reset\t\t-\tClear the board" << endl;
 	cout << "board\t\t-\tPrints the words currently on the board" << endl;
 	cout << "score <word>\t-\tCompute how good a given clue would be" << endl;
+	cout << "stats\t\t-\tPrints statistics of the last search for clues" << endl;
 	cout << "quit\t\t-\tTerminates the program" << endl;
 }
 
@@ -142,6 +143,17 @@ void GameInterface::commandModifyBoard(const string &command) {
 	bot->setWords(myWords, opponentWords, civilianWords, assassinWords);
 }
 
+void GameInterface::commandStats() {
+	const Bot::ScanStats &stats = bot->lastScanStats;
+	cout << "Candidates: " << stats.candidates << endl;
+	cout << "Pruned without scoring: " << stats.pruned;
+	if (stats.candidates > 0) {
+		cout << " (" << setprecision(1) << fixed << 100.0 * stats.pruned / stats.candidates
+			 << "%)";
+	}
+	cout << endl;
+}
+
 void GameInterface::commandScore() {
 	string word;
 	cin >> word;
@@ -196,6 +208,8 @@ void GameInterface::run() {
 			commandBoard();
 		} else if (command == "score") {
 			commandScore();
+		} else if (command == "stats") {
+			commandStats();
 		} else {
 			cout << "Unknown command \"" << command << "\"" << endl;
 		}
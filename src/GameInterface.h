@@ -36,6 +36,8 @@ class GameInterface {
 
 	void commandScore();
 
+	void commandStats();
+
 	std::string inputColor();
 
    public:
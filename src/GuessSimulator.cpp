@@ -0,0 +1,177 @@
+#include "GuessSimulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+
+using namespace std;
+
+namespace {
+
+/** The SplitMix64 output function, which turns a counter into 64 random bits */
+uint64_t counterRandom(uint64_t seed, uint64_t counter) {
+	uint64_t z = seed + (counter + 1) * 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/** Uniform number in (0, 1] from 32 random bits */
+double toUniform(uint32_t bits) {
+	return (bits + 1.0) * (1.0 / 4294967296.0);
+}
+
+}  // namespace
+
+void GuessSimulator::prepare(int boardSize) {
+	int groups = (simulations + LANES - 1) / LANES;
+	if (boardSize == preparedSize && simulations == preparedSimulations && seed == preparedSeed) {
+		return;
+	}
+	uniforms.resize((size_t)groups * boardSize * LANES);
+	normals.resize(uniforms.size());
+	rep(group, 0, groups) {
+		rep(j, 0, boardSize) {
+			rep(lane, 0, LANES) {
+				uint64_t simulation = (uint64_t)group * LANES + lane;
+				size_t index = ((size_t)group * boardSize + j) * LANES + lane;
+				uint64_t known = counterRandom(seed, simulation << 33 | (uint64_t)j << 1);
+				uint64_t gauss = counterRandom(seed, simulation << 33 | (uint64_t)j << 1 | 1);
+				uniforms[index] = (float)toUniform((uint32_t)known);
+				// Box-Muller transform
+				double radius = sqrt(-2 * log(toUniform((uint32_t)(gauss >> 32))));
+				double angle = 2 * M_PI * toUniform((uint32_t)gauss);
+				normals[index] = (float)(radius * cos(angle));
+			}
+		}
+	}
+	preparedSize = boardSize;
+	preparedSimulations = simulations;
+	preparedSeed = seed;
+}
+
+float GuessSimulator::expectedScore(const vector<Bot::BoardWord> &board, const float *similarities,
+									int number) const {
+	vector<float> scores(number);
+	expectedScores(board, similarities, number, scores.data());
+	return scores[number - 1];
+}
+
+void GuessSimulator::expectedScores(const vector<Bot::BoardWord> &board,
+									const float *similarities, int maxNumber,
+									float *scores) const {
+	Tally tally;
+	simulate(board, similarities, maxNumber, 0, groupCount(), tally);
+	rep(i, 0, maxNumber) {
+		scores[i] = (float)tally.mean(i + 1);
+	}
+}
+
+int GuessSimulator::groupCount() const {
+	return preparedSimulations / LANES + (preparedSimulations % LANES != 0);
+}
+
+double GuessSimulator::Tally::mean(int number) const {
+	return count == 0 ? 0 : sums[number - 1] / count;
+}
+
+double GuessSimulator::Tally::standardError(int number) const {
+	if (count < 2) {
+		return numeric_limits<double>::infinity();
+	}
+	double average = mean(number);
+	double variance = (squares[number - 1] / count - average * average) * count / (count - 1);
+	return sqrt(max(variance, 0.0) / count);
+}
+
+void GuessSimulator::simulate(const vector<Bot::BoardWord> &board, const float *similarities,
+							  int maxNumber, int first, int count, Tally &tally) const {
+	typedef Bot::CardType CardType;
+	const float removed = -numeric_limits<float>::infinity();
+	int n = (int)board.size();
+	tally.sums.resize(maxNumber, 0.0);
+	tally.squares.resize(maxNumber, 0.0);
+
+	// Per board word: the probability that the team knows it, the score of guessing it and
+	// whether guessing it ends the turn
+	vector<float> score(n), probability(n), gain(n), stop(n);
+	rep(j, 0, n) {
+		score[j] = similarities[j] - 0.15f;
+		probability[j] = (2 - score[j]) * score[j] + 0.05f;
+		CardType type = board[j].type;
+		gain[j] = type == CardType::MINE ? 1 : type == CardType::CIVILIAN ? 0
+											: type == CardType::OPPONENT ? -1 : -3;
+		stop[j] = type != CardType::MINE;
+	}
+
+	vector<float> noisy((size_t)n * LANES);
+	float best[LANES], bestGain[LANES], bestStop[LANES], active[LANES], sum[LANES];
+	int chosen[LANES];
+	rep(group, first, min(first + count, groupCount())) {
+		const float *uniform = &uniforms[(size_t)group * n * LANES];
+		const float *normal = &normals[(size_t)group * n * LANES];
+		rep(j, 0, n) {
+			rep(lane, 0, LANES) {
+				float value = score[j] + noise * normal[j * LANES + lane];
+				noisy[j * LANES + lane] =
+					probability[j] >= uniform[j * LANES + lane] ? value : removed;
+			}
+		}
+		rep(lane, 0, LANES) {
+			active[lane] = 1;
+			sum[lane] = 0;
+		}
+		// Simulations beyond the requested number only exist to fill the last group
+		int lanes = min(LANES, preparedSimulations - group * LANES);
+		int guess = 0;
+		while (guess < maxNumber) {
+			// Every active simulation guesses its most similar remaining word
+			rep(lane, 0, LANES) {
+				best[lane] = removed;
+				bestGain[lane] = 0;
+				bestStop[lane] = 1;
+				chosen[lane] = -1;
+			}
+			rep(j, 0, n) {
+				rep(lane, 0, LANES) {
+					bool better = noisy[j * LANES + lane] > best[lane];
+					best[lane] = better ? noisy[j * LANES + lane] : best[lane];
+					bestGain[lane] = better ? gain[j] : bestGain[lane];
+					bestStop[lane] = better ? stop[j] : bestStop[lane];
+					chosen[lane] = better ? j : chosen[lane];
+				}
+			}
+			float stillActive = 0;
+			rep(lane, 0, LANES) {
+				sum[lane] += active[lane] * bestGain[lane];
+				active[lane] *= 1 - bestStop[lane];
+				stillActive += active[lane];
+			}
+			// The score after this guess is the score of a clue with number guess + 1
+			rep(lane, 0, lanes) {
+				tally.sums[guess] += sum[lane];
+				tally.squares[guess] += sum[lane] * sum[lane];
+			}
+			guess++;
+			if (stillActive == 0) {
+				break;
+			}
+			rep(j, 0, n) {
+				rep(lane, 0, LANES) {
+					bool guessed = chosen[lane] == j;
+					noisy[j * LANES + lane] = guessed ? removed : noisy[j * LANES + lane];
+				}
+			}
+		}
+		// All simulations have ended, so larger numbers score the same
+		for (; guess < maxNumber; guess++) {
+			rep(lane, 0, lanes) {
+				tally.sums[guess] += sum[lane];
+				tally.squares[guess] += sum[lane] * sum[lane];
+			}
+		}
+		tally.count += lanes;
+	}
+}
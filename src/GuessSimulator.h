@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Bot.h"
+
+#include <cstdint>
+#include <vector>
+
+/** Monte Carlo model of how a team guesses after a clue.
+ *
+ * In every simulation each board word is known to the team with a probability that grows with
+ * its similarity to the clue. The team then guesses known words in order of similarity plus
+ * normally distributed noise, scoring 1 for each own word, until it has made as many guesses as
+ * the number of the clue or hits a word of another type: civilians end the turn, opponent words
+ * cost 1 and the assassin costs 3.
+ *
+ * Simulations are run in groups of LANES, with everything that varies between simulations
+ * stored as arrays over the group, so that the loops over a group compile to SIMD instructions.
+ *
+ * The random numbers come from a counter-based generator: the draws of simulation s for board
+ * word j are a hash of (seed, s, j). A simulation therefore gives the same result whichever
+ * thread runs it, and all clues are evaluated on the same random numbers, which makes the
+ * differences between clues less noisy. The draws only depend on the board size, so they are
+ * generated once by #prepare and shared by all calls.
+ */
+struct GuessSimulator {
+	static const int LANES = 16;
+
+	/** Running totals over the simulations of one clue */
+	struct Tally {
+		// Number of simulations
+		int count = 0;
+
+		// Sum of the scores and of their squares, per clue number minus one
+		std::vector<double> sums, squares;
+
+		/** Average score for a clue with the given number */
+		double mean(int number) const;
+
+		/** Standard error of #mean */
+		double standardError(int number) const;
+	};
+
+	// Number of simulations per clue
+	int simulations = 1000;
+
+	uint64_t seed = 0;
+
+	// Standard deviation of the noise added to the similarities before ordering the guesses
+	float noise = 0.12f;
+
+	/** Generates the random numbers for a board with the given number of words, if this was not
+	 * already done. Must be called before #expectedScore, and not concurrently with it. */
+	void prepare(int boardSize);
+
+	/** Average score of the team after a clue with the given number, where similarities holds
+	 * the similarity of the clue to each board word. Safe to call from several threads. */
+	float expectedScore(const std::vector<Bot::BoardWord> &board, const float *similarities,
+						int number) const;
+
+	/** Writes the average score after a clue with number i + 1 to scores[i], for every number
+	 * up to maxNumber. The guesses for a clue only depend on its number through when the team
+	 * stops, so every simulation is played once and its score is recorded after each guess. The
+	 * results are the same as those of #expectedScore. */
+	void expectedScores(const std::vector<Bot::BoardWord> &board, const float *similarities,
+						int maxNumber, float *scores) const;
+
+	/** Plays the simulation groups first to first+count-1 of a clue and adds their scores for
+	 * every number up to maxNumber to the tally. Continuing a tally where the previous call
+	 * stopped gives the same totals as simulating all groups at once. */
+	void simulate(const std::vector<Bot::BoardWord> &board, const float *similarities,
+				  int maxNumber, int first, int count, Tally &tally) const;
+
+	/** Number of groups of LANES simulations, covering #simulations */
+	int groupCount() const;
+
+   private:
+	int preparedSize = -1, preparedSimulations = -1;
+	uint64_t preparedSeed = 0;
+
+	// Draws of every simulation group, LANES consecutive values per board word: a uniform
+	// number that decides if the word is known and the noise on its similarity
+	std::vector<float> uniforms, normals;
+};
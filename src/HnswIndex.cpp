@@ -0,0 +1,322 @@
+#include "HnswIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <random>
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+#define trav(x, v) for (auto &x : v)
+#define all(v) (v).begin(), (v).end()
+
+using namespace std;
+
+typedef pair<float, int> Candidate;
+
+namespace {
+
+/** Marks the nodes seen by the current search. Clearing is O(1) by bumping the epoch. */
+struct VisitedSet {
+	vector<unsigned> marks;
+	unsigned epoch = 0;
+
+	void reset(int size) {
+		if ((int)marks.size() < size) {
+			marks.assign(size, 0);
+			epoch = 0;
+		}
+		if (++epoch == 0) {
+			fill(all(marks), 0);
+			epoch = 1;
+		}
+	}
+
+	/** Returns false if the node was already visited */
+	inline bool visit(int node) {
+		if (marks[node] == epoch) {
+			return false;
+		}
+		marks[node] = epoch;
+		return true;
+	}
+};
+
+}  // namespace
+
+const int *HnswIndex::neighbors(int node, int level, int *count) const {
+	if (level == 0) {
+		*count = linkCounts0[node];
+		return &links0[(size_t)node * maxM0];
+	}
+	const vector<int> &links = upperLinks[node][level - 1];
+	*count = (int)links.size();
+	return links.data();
+}
+
+void HnswIndex::setNeighbors(int node, int level, const vector<int> &nodes) {
+	if (level == 0) {
+		linkCounts0[node] = (int)nodes.size();
+		copy(all(nodes), links0.begin() + (size_t)node * maxM0);
+	} else {
+		upperLinks[node][level - 1] = nodes;
+	}
+}
+
+vector<Candidate> HnswIndex::searchLevel(const QuerySimilarity &similarity, int entry, int ef,
+										 int level) const {
+	static thread_local VisitedSet visited;
+	visited.reset(size());
+	// Candidates to expand, most similar first, and the ef best nodes so far, least similar first
+	priority_queue<Candidate> candidates;
+	priority_queue<Candidate, vector<Candidate>, greater<Candidate>> best;
+	Candidate start(similarity(entry), entry);
+	visited.visit(entry);
+	candidates.push(start);
+	best.push(start);
+	while (!candidates.empty()) {
+		Candidate current = candidates.top();
+		if ((int)best.size() >= ef && current.first < best.top().first) {
+			break;
+		}
+		candidates.pop();
+		int count;
+		const int *links = neighbors(current.second, level, &count);
+		rep(i, 0, count) {
+			int node = links[i];
+			if (!visited.visit(node)) {
+				continue;
+			}
+			float sim = similarity(node);
+			if ((int)best.size() < ef || sim > best.top().first) {
+				candidates.push(Candidate(sim, node));
+				best.push(Candidate(sim, node));
+				if ((int)best.size() > ef) {
+					best.pop();
+				}
+			}
+		}
+	}
+	vector<Candidate> res;
+	while (!best.empty()) {
+		res.push_back(best.top());
+		best.pop();
+	}
+	reverse(all(res));
+	return res;
+}
+
+int HnswIndex::descend(const QuerySimilarity &similarity, int entry, int target) const {
+	int current = entry;
+	float currentSim = similarity(current);
+	for (int level = maxLevel; level > target; level--) {
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			int count;
+			const int *links = neighbors(current, level, &count);
+			rep(i, 0, count) {
+				float sim = similarity(links[i]);
+				if (sim > currentSim) {
+					currentSim = sim;
+					current = links[i];
+					changed = true;
+				}
+			}
+		}
+	}
+	return current;
+}
+
+vector<int> HnswIndex::selectNeighbors(const vector<Candidate> &candidates, int maxCount,
+									   const RowSimilarity &similarity) const {
+	vector<int> picked, rest;
+	trav(candidate, candidates) {
+		if ((int)picked.size() >= maxCount) {
+			break;
+		}
+		bool diverse = true;
+		trav(other, picked) {
+			if (similarity(candidate.second, other) > candidate.first) {
+				diverse = false;
+				break;
+			}
+		}
+		(diverse ? picked : rest).push_back(candidate.second);
+	}
+	for (int i = 0; i < (int)rest.size() && (int)picked.size() < maxCount; i++) {
+		picked.push_back(rest[i]);
+	}
+	return picked;
+}
+
+void HnswIndex::build(int rows, const RowSimilarity &similarity, const Params &params) {
+	clear();
+	M = max(params.M, 2);
+	maxM0 = 2 * M;
+	mt19937 rng(params.seed);
+	uniform_real_distribution<double> uniform(0.0, 1.0);
+	double levelFactor = 1 / log((double)M);
+	levels.resize(rows);
+	upperLinks.resize(rows);
+	rep(i, 0, rows) {
+		levels[i] = (int)floor(-log(1.0 - uniform(rng)) * levelFactor);
+		upperLinks[i].resize(levels[i]);
+	}
+	links0.assign((size_t)rows * maxM0, 0);
+	linkCounts0.assign(rows, 0);
+
+	rep(node, 0, rows) {
+		QuerySimilarity toNode = [&](int other) { return similarity(node, other); };
+		if (entryPoint == -1) {
+			entryPoint = node;
+			maxLevel = levels[node];
+			continue;
+		}
+		int entry = descend(toNode, entryPoint, levels[node]);
+		for (int level = min(levels[node], maxLevel); level >= 0; level--) {
+			vector<Candidate> found = searchLevel(toNode, entry, params.efConstruction, level);
+			vector<int> chosen = selectNeighbors(found, M, similarity);
+			setNeighbors(node, level, chosen);
+
+			// Link back, pruning the other node's links if it now has too many
+			int maxLinks = level == 0 ? maxM0 : M;
+			trav(other, chosen) {
+				int count;
+				const int *links = neighbors(other, level, &count);
+				vector<int> updated(links, links + count);
+				updated.push_back(node);
+				if ((int)updated.size() > maxLinks) {
+					vector<Candidate> candidates;
+					trav(x, updated) {
+						candidates.push_back(Candidate(similarity(other, x), x));
+					}
+					sort(all(candidates), greater<Candidate>());
+					updated = selectNeighbors(candidates, maxLinks, similarity);
+				}
+				setNeighbors(other, level, updated);
+			}
+			entry = found[0].second;
+		}
+		if (levels[node] > maxLevel) {
+			maxLevel = levels[node];
+			entryPoint = node;
+		}
+	}
+}
+
+vector<Candidate> HnswIndex::search(const QuerySimilarity &similarity, int k, int ef) const {
+	if (empty() || k <= 0) {
+		return vector<Candidate>();
+	}
+	int entry = descend(similarity, entryPoint, 0);
+	vector<Candidate> res = searchLevel(similarity, entry, max(ef, k), 0);
+	if ((int)res.size() > k) {
+		res.resize(k);
+	}
+	return res;
+}
+
+void HnswIndex::clear() {
+	fingerprint = 0;
+	M = maxM0 = 0;
+	entryPoint = maxLevel = -1;
+	levels.clear();
+	links0.clear();
+	linkCounts0.clear();
+	upperLinks.clear();
+}
+
+bool HnswIndex::save(const string &fileName) const {
+	ofstream fout(fileName, ios::binary);
+	auto writeInt = [&](int x) { fout.write((const char *)&x, sizeof x); };
+	auto writeInts = [&](const vector<int> &v) {
+		fout.write((const char *)v.data(), v.size() * sizeof(int));
+	};
+	writeInt(MAGIC);
+	writeInt(VERSION);
+	fout.write((const char *)&fingerprint, sizeof fingerprint);
+	writeInt(size());
+	writeInt(M);
+	writeInt(entryPoint);
+	writeInt(maxLevel);
+	writeInts(levels);
+	writeInts(linkCounts0);
+	writeInts(links0);
+	rep(i, 0, size()) {
+		trav(links, upperLinks[i]) {
+			writeInt((int)links.size());
+			writeInts(links);
+		}
+	}
+	return (bool)fout;
+}
+
+bool HnswIndex::load(const string &fileName) {
+	clear();
+	ifstream fin(fileName, ios::binary);
+	auto readInt = [&]() {
+		int x = 0;
+		fin.read((char *)&x, sizeof x);
+		return x;
+	};
+	auto readInts = [&](vector<int> &v, size_t count) {
+		v.resize(count);
+		fin.read((char *)v.data(), count * sizeof(int));
+	};
+	if (readInt() != MAGIC || readInt() != VERSION) {
+		return false;
+	}
+	fin.read((char *)&fingerprint, sizeof fingerprint);
+	int rows = readInt();
+	M = readInt();
+	maxM0 = 2 * M;
+	entryPoint = readInt();
+	maxLevel = readInt();
+	if (!fin || rows < 0 || M < 2 || entryPoint < -1 || entryPoint >= rows) {
+		clear();
+		return false;
+	}
+	readInts(levels, rows);
+	readInts(linkCounts0, rows);
+	readInts(links0, (size_t)rows * maxM0);
+	upperLinks.resize(rows);
+	rep(i, 0, rows) {
+		if (!fin || levels[i] < 0 || levels[i] > maxLevel) {
+			clear();
+			return false;
+		}
+		upperLinks[i].resize(levels[i]);
+		trav(links, upperLinks[i]) {
+			int count = readInt();
+			if (!fin || count < 0 || count > M) {
+				clear();
+				return false;
+			}
+			readInts(links, count);
+		}
+	}
+	if (!fin) {
+		clear();
+		return false;
+	}
+	// Check the links as well, so that a damaged file cannot lead to out of bounds accesses
+	auto valid = [&](int node) { return node >= 0 && node < rows; };
+	rep(i, 0, rows) {
+		bool ok = linkCounts0[i] >= 0 && linkCounts0[i] <= maxM0;
+		rep(j, 0, ok ? linkCounts0[i] : 0) {
+			ok = ok && valid(links0[(size_t)i * maxM0 + j]);
+		}
+		trav(links, upperLinks[i]) {
+			trav(node, links) {
+				ok = ok && valid(node);
+			}
+		}
+		if (!ok) {
+			clear();
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Hierarchical navigable small world graph (Malkov & Yashunin) for approximate maximum
+ * similarity search over the rows of an embedding matrix.
+ *
+ * The index only stores the graph. Similarities are computed through callbacks, so the same
+ * index works whatever form the engine stores its vectors in.
+ */
+struct HnswIndex {
+	struct Params {
+		// Number of links per node on the upper levels, twice as many are kept on level 0
+		int M = 16;
+
+		// Size of the candidate list while inserting, higher values give a better graph
+		int efConstruction = 200;
+
+		unsigned seed = 1;
+	};
+
+	// Identifies the vectors the graph was built over. It is stored with the graph, so that the
+	// owner can tell whether a loaded graph belongs to its vectors.
+	uint64_t fingerprint = 0;
+
+	/** Similarity between two rows */
+	typedef std::function<float(int, int)> RowSimilarity;
+
+	/** Similarity between the query and a row */
+	typedef std::function<float(int)> QuerySimilarity;
+
+	/** Builds the graph over rows 0 to rows-1 */
+	void build(int rows, const RowSimilarity &similarity, const Params &params);
+
+	/** Returns up to k (similarity, row) pairs, most similar first. ef is the size of the
+	 * candidate list, which trades speed for recall; it is raised to k if lower. */
+	std::vector<std::pair<float, int>> search(const QuerySimilarity &similarity, int k,
+											  int ef) const;
+
+	/** Returns true if successful */
+	bool save(const std::string &fileName) const;
+
+	/** Returns true if successful */
+	bool load(const std::string &fileName);
+
+	void clear();
+
+	inline int size() const {
+		return (int)levels.size();
+	}
+
+	inline bool empty() const {
+		return levels.empty();
+	}
+
+   private:
+	static const int MAGIC = 0x57534e48;  // "HNSW"
+	static const int VERSION = 2;
+
+	int M = 0, maxM0 = 0;
+	int entryPoint = -1, maxLevel = -1;
+
+	// Top level of every node
+	std::vector<int> levels;
+
+	// Level 0 links of every node, maxM0 slots per node of which linkCounts0 are used
+	std::vector<int> links0;
+	std::vector<int> linkCounts0;
+
+	// Links on levels 1 to levels[i] of node i
+	std::vector<std::vector<std::vector<int>>> upperLinks;
+
+	/** The links of a node on a level, with their number stored in count */
+	const int *neighbors(int node, int level, int *count) const;
+
+	void setNeighbors(int node, int level, const std::vector<int> &nodes);
+
+	/** Best first search on one level from the given entry point. Returns the ef most similar
+	 * nodes found, sorted by decreasing similarity. */
+	std::vector<std::pair<float, int>> searchLevel(const QuerySimilarity &similarity, int entry,
+												   int ef, int level) const;
+
+	/** Moves greedily towards the query on the levels above target, returns the final node */
+	int descend(const QuerySimilarity &similarity, int entry, int target) const;
+
+	/** Picks up to maxCount of the candidates (sorted by decreasing similarity to the base node)
+	 * that are more similar to the base than to any already picked candidate, which keeps the
+	 * links of a node spread out in different directions. Fills up with the remaining
+	 * candidates if there are too few of those. */
+	std::vector<int> selectNeighbors(const std::vector<std::pair<float, int>> &candidates,
+									 int maxCount, const RowSimilarity &similarity) const;
+};
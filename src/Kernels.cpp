@@ -0,0 +1,960 @@
+#include "Kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+
+using namespace std;
+
+uint16_t floatToHalf(float x) {
+	uint32_t f;
+	memcpy(&f, &x, sizeof f);
+	uint32_t sign = (f >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((f >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = f & 0x7fffff;
+	if (((f >> 23) & 0xff) == 0xff) {
+		// Infinity or NaN
+		return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	}
+	if (exponent >= 31) {
+		return (uint16_t)(sign | 0x7c00);
+	}
+	if (exponent <= 0) {
+		if (exponent < -10) {
+			return (uint16_t)sign;
+		}
+		// Subnormal half, round to nearest even
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t midpoint = 1u << (shift - 1);
+		if (rest > midpoint || (rest == midpoint && (half & 1))) {
+			half++;
+		}
+		return (uint16_t)(sign | half);
+	}
+	uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		// May carry into the exponent, which correctly rounds up to the next power of two
+		half++;
+	}
+	return (uint16_t)half;
+}
+
+float halfToFloat(uint16_t h) {
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	uint32_t f;
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			f = sign;
+		} else {
+			// Subnormal half, renormalize
+			exponent = 127 - 15 + 1;
+			while (!(mantissa & 0x400)) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+		}
+	} else if (exponent == 31) {
+		f = sign | 0x7f800000 | (mantissa << 13);
+	} else {
+		f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+	float x;
+	memcpy(&x, &f, sizeof x);
+	return x;
+}
+
+namespace {
+
+// Portable versions, also used for the tails of the vectorized ones
+
+float dotProductScalar(const float *a, const float *b, int n) {
+	float sum = 0;
+	rep(i, 0, n) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+float squaredDistanceScalar(const float *a, const float *b, int n) {
+	float sum = 0;
+	rep(i, 0, n) {
+		float diff = a[i] - b[i];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+float dotProductHalfScalar(const float *a, const uint16_t *b, int n) {
+	float sum = 0;
+	rep(i, 0, n) {
+		sum += a[i] * halfToFloat(b[i]);
+	}
+	return sum;
+}
+
+float squaredDistanceHalfScalar(const uint16_t *a, const uint16_t *b, int n) {
+	float sum = 0;
+	rep(i, 0, n) {
+		float diff = halfToFloat(a[i]) - halfToFloat(b[i]);
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+float dotProductByteScalar(const float *a, const int8_t *b, int n) {
+	float sum = 0;
+	rep(i, 0, n) {
+		sum += a[i] * (float)b[i];
+	}
+	return sum;
+}
+
+float squaredDistanceByteScalar(const int8_t *a, float scaleA, const int8_t *b, float scaleB,
+								int n) {
+	float sum = 0;
+	rep(i, 0, n) {
+		float diff = scaleA * (float)a[i] - scaleB * (float)b[i];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+void squaredDistances2x2Scalar(const float *a, const float *b, int n, float *out) {
+	rep(i, 0, 2) {
+		rep(j, 0, 2) {
+			out[2 * i + j] = squaredDistanceScalar(a + i * n, b + j * n, n);
+		}
+	}
+}
+
+void squaredDistances2x2HalfScalar(const uint16_t *a, const uint16_t *b, int n, float *out) {
+	rep(i, 0, 2) {
+		rep(j, 0, 2) {
+			out[2 * i + j] = squaredDistanceHalfScalar(a + i * n, b + j * n, n);
+		}
+	}
+}
+
+void squaredDistances2x2ByteScalar(const int8_t *a, const float *scalesA, const int8_t *b,
+								   const float *scalesB, int n, float *out) {
+	rep(i, 0, 2) {
+		rep(j, 0, 2) {
+			out[2 * i + j] =
+				squaredDistanceByteScalar(a + i * n, scalesA[i], b + j * n, scalesB[j], n);
+		}
+	}
+}
+
+// exp(x) = 2^k e^r with k = round(x / ln 2). LN2_HIGH has few enough bits that k * LN2_HIGH is
+// exact, so r = x - k ln 2 loses no precision. e^r = 1 + r + r^2 p(r), where p is the polynomial
+// with coefficients EXP_POLYNOMIAL, highest degree first (from Cephes' expf).
+const float LOG2E = 1.44269504088896341f;
+const float LN2_HIGH = 0.693359375f;
+const float LN2_LOW = -2.12194440e-4f;
+const float EXP_POLYNOMIAL[6] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+								 4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+// round(x / ln 2) for x in [EXP_MIN, EXP_MAX], computed by truncating a positive number
+const float EXP_ROUNDING_OFFSET = 126.5f;
+
+/** Returns x, without letting -Ofast reassociate the arithmetic on either side of it. Needed for
+ * x - k * LN2_HIGH, which would otherwise be merged with the subtraction of k * LN2_LOW and be
+ * rounded to the precision of x, costing up to 60 ulp in exp. */
+template <class T>
+inline T barrier(T x) {
+#ifdef X86_KERNELS
+	asm("" : "+x"(x));
+	return x;
+#else
+	volatile T copy = x;
+	return copy;
+#endif
+}
+
+float expScalar(float x) {
+	x = min(max(x, EXP_MIN), EXP_MAX);
+	int k = (int)(x * LOG2E + EXP_ROUNDING_OFFSET) - 126;
+	float r = barrier(x - k * LN2_HIGH) - k * LN2_LOW;
+	float p = EXP_POLYNOMIAL[0];
+	rep(i, 1, 6) {
+		p = p * r + EXP_POLYNOMIAL[i];
+	}
+	uint32_t bits = (uint32_t)(k + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof scale);
+	return (1 + r + r * r * p) * scale;
+}
+
+float sigmoidScalar(float x) {
+	return 1 / (1 + expScalar(-x));
+}
+
+void expArrayScalar(const float *in, float *out, int n) {
+	rep(i, 0, n) {
+		out[i] = expScalar(in[i]);
+	}
+}
+
+void sigmoidArrayScalar(const float *in, float *out, int n) {
+	rep(i, 0, n) {
+		out[i] = sigmoidScalar(in[i]);
+	}
+}
+
+void expArrayLibm(const float *in, float *out, int n) {
+	rep(i, 0, n) {
+		out[i] = std::exp(in[i]);
+	}
+}
+
+void sigmoidArrayLibm(const float *in, float *out, int n) {
+	rep(i, 0, n) {
+		out[i] = 1 / (1 + std::exp(-in[i]));
+	}
+}
+
+/** Adds the squared distances of the elements from start to n to the four sums in out */
+template <class Distance>
+void addDistanceTails(int start, int n, float *out, Distance distance) {
+	rep(k, start, n) {
+		rep(p, 0, 4) {
+			float diff = distance(p >> 1, p & 1, k);
+			out[p] += diff * diff;
+		}
+	}
+}
+
+#ifdef X86_KERNELS
+
+// SSE2 is part of every x86-64 CPU. There is no fp16 or byte widening instruction before
+// F16C and SSE4.1, so the quantized kernels use the scalar versions at this level.
+
+__attribute__((target("sse2"))) float horizontalSum(__m128 v) {
+	__m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm_add_ps(v, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, v);
+	return _mm_cvtss_f32(_mm_add_ss(v, shuffled));
+}
+
+__attribute__((target("sse2"))) float dotProductSSE(const float *a, const float *b, int n) {
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	for (; i + 4 <= n; i += 4) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	}
+	return horizontalSum(_mm_add_ps(acc0, acc1)) + dotProductScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) float squaredDistanceSSE(const float *a, const float *b, int n) {
+	__m128 acc = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+		acc = _mm_add_ps(acc, _mm_mul_ps(diff, diff));
+	}
+	return horizontalSum(acc) + squaredDistanceScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) void squaredDistances2x2SSE(const float *a, const float *b, int n,
+															 float *out) {
+	__m128 acc00 = _mm_setzero_ps(), acc01 = _mm_setzero_ps();
+	__m128 acc10 = _mm_setzero_ps(), acc11 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 a0 = _mm_loadu_ps(a + i), a1 = _mm_loadu_ps(a + n + i);
+		__m128 b0 = _mm_loadu_ps(b + i), b1 = _mm_loadu_ps(b + n + i);
+		__m128 d00 = _mm_sub_ps(a0, b0), d01 = _mm_sub_ps(a0, b1);
+		__m128 d10 = _mm_sub_ps(a1, b0), d11 = _mm_sub_ps(a1, b1);
+		acc00 = _mm_add_ps(acc00, _mm_mul_ps(d00, d00));
+		acc01 = _mm_add_ps(acc01, _mm_mul_ps(d01, d01));
+		acc10 = _mm_add_ps(acc10, _mm_mul_ps(d10, d10));
+		acc11 = _mm_add_ps(acc11, _mm_mul_ps(d11, d11));
+	}
+	out[0] = horizontalSum(acc00);
+	out[1] = horizontalSum(acc01);
+	out[2] = horizontalSum(acc10);
+	out[3] = horizontalSum(acc11);
+	addDistanceTails(i, n, out, [&](int x, int y, int k) { return a[x * n + k] - b[y * n + k]; });
+}
+
+__attribute__((target("sse2"))) __m128 expSSE(__m128 x) {
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_MIN)), _mm_set1_ps(EXP_MAX));
+	__m128 t = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(LOG2E)), _mm_set1_ps(EXP_ROUNDING_OFFSET));
+	__m128i k = _mm_sub_epi32(_mm_cvttps_epi32(t), _mm_set1_epi32(126));
+	__m128 kf = _mm_cvtepi32_ps(k);
+	__m128 r = _mm_sub_ps(barrier(_mm_sub_ps(x, _mm_mul_ps(kf, _mm_set1_ps(LN2_HIGH)))),
+						  _mm_mul_ps(kf, _mm_set1_ps(LN2_LOW)));
+	__m128 p = _mm_set1_ps(EXP_POLYNOMIAL[0]);
+	rep(i, 1, 6) {
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_POLYNOMIAL[i]));
+	}
+	__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, r), p), r), _mm_set1_ps(1));
+	__m128i scale = _mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(y, _mm_castsi128_ps(scale));
+}
+
+__attribute__((target("sse2"))) void expArraySSE(const float *in, float *out, int n) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(out + i, expSSE(_mm_loadu_ps(in + i)));
+	}
+	expArrayScalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2"))) void sigmoidArraySSE(const float *in, float *out, int n) {
+	__m128 one = _mm_set1_ps(1);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 e = expSSE(_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(in + i)));
+		_mm_storeu_ps(out + i, _mm_div_ps(one, _mm_add_ps(one, e)));
+	}
+	sigmoidArrayScalar(in + i, out + i, n - i);
+}
+
+// AVX2 CPUs all have FMA and F16C as well
+
+__attribute__((target("avx2,fma,f16c"))) float horizontalSum(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuffled = _mm_movehdup_ps(sum);
+	sum = _mm_add_ps(sum, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sum);
+	return _mm_cvtss_f32(_mm_add_ss(sum, shuffled));
+}
+
+__attribute__((target("avx2,fma,f16c"))) float dotProductAVX2(const float *a, const float *b,
+																int n) {
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+	}
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+	}
+	return horizontalSum(_mm256_add_ps(acc0, acc1)) + dotProductScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) float squaredDistanceAVX2(const float *a, const float *b,
+																	 int n) {
+	__m256 acc = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		acc = _mm256_fmadd_ps(diff, diff, acc);
+	}
+	return horizontalSum(acc) + squaredDistanceScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) float dotProductHalfAVX2(const float *a,
+																	const uint16_t *b, int n) {
+	__m256 acc = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 bs = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + i)));
+		acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), bs, acc);
+	}
+	return horizontalSum(acc) + dotProductHalfScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) float squaredDistanceHalfAVX2(const uint16_t *a,
+																		 const uint16_t *b, int n) {
+	__m256 acc = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 as = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(a + i)));
+		__m256 bs = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + i)));
+		__m256 diff = _mm256_sub_ps(as, bs);
+		acc = _mm256_fmadd_ps(diff, diff, acc);
+	}
+	return horizontalSum(acc) + squaredDistanceHalfScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) __m256 loadBytesAVX2(const int8_t *p) {
+	return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+__attribute__((target("avx2,fma,f16c"))) float dotProductByteAVX2(const float *a, const int8_t *b,
+																	int n) {
+	__m256 acc = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), loadBytesAVX2(b + i), acc);
+	}
+	return horizontalSum(acc) + dotProductByteScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) float squaredDistanceByteAVX2(const int8_t *a,
+																		 float scaleA,
+																		 const int8_t *b,
+																		 float scaleB, int n) {
+	__m256 acc = _mm256_setzero_ps();
+	__m256 sa = _mm256_set1_ps(scaleA), sb = _mm256_set1_ps(scaleB);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 diff = _mm256_fmsub_ps(sa, loadBytesAVX2(a + i),
+									  _mm256_mul_ps(sb, loadBytesAVX2(b + i)));
+		acc = _mm256_fmadd_ps(diff, diff, acc);
+	}
+	return horizontalSum(acc) + squaredDistanceByteScalar(a + i, scaleA, b + i, scaleB, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) void squaredDistances2x2AVX2(const float *a,
+																		 const float *b, int n,
+																		 float *out) {
+	__m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+	__m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 a0 = _mm256_loadu_ps(a + i), a1 = _mm256_loadu_ps(a + n + i);
+		__m256 b0 = _mm256_loadu_ps(b + i), b1 = _mm256_loadu_ps(b + n + i);
+		__m256 d00 = _mm256_sub_ps(a0, b0), d01 = _mm256_sub_ps(a0, b1);
+		__m256 d10 = _mm256_sub_ps(a1, b0), d11 = _mm256_sub_ps(a1, b1);
+		acc00 = _mm256_fmadd_ps(d00, d00, acc00);
+		acc01 = _mm256_fmadd_ps(d01, d01, acc01);
+		acc10 = _mm256_fmadd_ps(d10, d10, acc10);
+		acc11 = _mm256_fmadd_ps(d11, d11, acc11);
+	}
+	out[0] = horizontalSum(acc00);
+	out[1] = horizontalSum(acc01);
+	out[2] = horizontalSum(acc10);
+	out[3] = horizontalSum(acc11);
+	addDistanceTails(i, n, out, [&](int x, int y, int k) { return a[x * n + k] - b[y * n + k]; });
+}
+
+__attribute__((target("avx2,fma,f16c"))) void squaredDistances2x2HalfAVX2(const uint16_t *a,
+																			const uint16_t *b,
+																			int n, float *out) {
+	__m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+	__m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 a0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(a + i)));
+		__m256 a1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(a + n + i)));
+		__m256 b0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + i)));
+		__m256 b1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + n + i)));
+		__m256 d00 = _mm256_sub_ps(a0, b0), d01 = _mm256_sub_ps(a0, b1);
+		__m256 d10 = _mm256_sub_ps(a1, b0), d11 = _mm256_sub_ps(a1, b1);
+		acc00 = _mm256_fmadd_ps(d00, d00, acc00);
+		acc01 = _mm256_fmadd_ps(d01, d01, acc01);
+		acc10 = _mm256_fmadd_ps(d10, d10, acc10);
+		acc11 = _mm256_fmadd_ps(d11, d11, acc11);
+	}
+	out[0] = horizontalSum(acc00);
+	out[1] = horizontalSum(acc01);
+	out[2] = horizontalSum(acc10);
+	out[3] = horizontalSum(acc11);
+	addDistanceTails(i, n, out, [&](int x, int y, int k) {
+		return halfToFloat(a[x * n + k]) - halfToFloat(b[y * n + k]);
+	});
+}
+
+__attribute__((target("avx2,fma,f16c"))) void squaredDistances2x2ByteAVX2(const int8_t *a,
+																			const float *scalesA,
+																			const int8_t *b,
+																			const float *scalesB,
+																			int n, float *out) {
+	__m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+	__m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+	__m256 sa0 = _mm256_set1_ps(scalesA[0]), sa1 = _mm256_set1_ps(scalesA[1]);
+	__m256 sb0 = _mm256_set1_ps(scalesB[0]), sb1 = _mm256_set1_ps(scalesB[1]);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 a0 = _mm256_mul_ps(sa0, loadBytesAVX2(a + i));
+		__m256 a1 = _mm256_mul_ps(sa1, loadBytesAVX2(a + n + i));
+		__m256 b0 = _mm256_mul_ps(sb0, loadBytesAVX2(b + i));
+		__m256 b1 = _mm256_mul_ps(sb1, loadBytesAVX2(b + n + i));
+		__m256 d00 = _mm256_sub_ps(a0, b0), d01 = _mm256_sub_ps(a0, b1);
+		__m256 d10 = _mm256_sub_ps(a1, b0), d11 = _mm256_sub_ps(a1, b1);
+		acc00 = _mm256_fmadd_ps(d00, d00, acc00);
+		acc01 = _mm256_fmadd_ps(d01, d01, acc01);
+		acc10 = _mm256_fmadd_ps(d10, d10, acc10);
+		acc11 = _mm256_fmadd_ps(d11, d11, acc11);
+	}
+	out[0] = horizontalSum(acc00);
+	out[1] = horizontalSum(acc01);
+	out[2] = horizontalSum(acc10);
+	out[3] = horizontalSum(acc11);
+	addDistanceTails(i, n, out, [&](int x, int y, int k) {
+		return scalesA[x] * (float)a[x * n + k] - scalesB[y] * (float)b[y * n + k];
+	});
+}
+
+__attribute__((target("avx2,fma,f16c"))) __m256 expAVX2(__m256 x) {
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)), _mm256_set1_ps(EXP_MAX));
+	__m256 t = _mm256_fmadd_ps(x, _mm256_set1_ps(LOG2E), _mm256_set1_ps(EXP_ROUNDING_OFFSET));
+	__m256i k = _mm256_sub_epi32(_mm256_cvttps_epi32(t), _mm256_set1_epi32(126));
+	__m256 kf = _mm256_cvtepi32_ps(k);
+	__m256 r = _mm256_fnmadd_ps(kf, _mm256_set1_ps(LN2_HIGH), x);
+	r = _mm256_fnmadd_ps(kf, _mm256_set1_ps(LN2_LOW), r);
+	__m256 p = _mm256_set1_ps(EXP_POLYNOMIAL[0]);
+	rep(i, 1, 6) {
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_POLYNOMIAL[i]));
+	}
+	__m256 y = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(r, r), p, r), _mm256_set1_ps(1));
+	__m256i scale = _mm256_slli_epi32(_mm256_add_epi32(k, _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(y, _mm256_castsi256_ps(scale));
+}
+
+__attribute__((target("avx2,fma,f16c"))) void expArrayAVX2(const float *in, float *out, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(out + i, expAVX2(_mm256_loadu_ps(in + i)));
+	}
+	expArraySSE(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) void sigmoidArrayAVX2(const float *in, float *out,
+															   int n) {
+	__m256 one = _mm256_set1_ps(1);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 e = expAVX2(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(in + i)));
+		_mm256_storeu_ps(out + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+	}
+	sigmoidArraySSE(in + i, out + i, n - i);
+}
+
+// AVX-512 handles the float tails with masked loads, the quantized ones with the scalar code.
+// GCC's AVX-512 headers start many intrinsics from an undefined register, which triggers false
+// uninitialized warnings once they are inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) __mmask16 tailMask(int remaining) {
+	return (__mmask16)((1u << remaining) - 1);
+}
+
+__attribute__((target("avx512f"))) float dotProductAVX512(const float *a, const float *b, int n) {
+	__m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 32 <= n; i += 32) {
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+		acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+	}
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+	}
+	if (i < n) {
+		__mmask16 mask = tailMask(n - i);
+		acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i),
+							   acc1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f"))) float squaredDistanceAVX512(const float *a, const float *b,
+																 int n) {
+	__m512 acc = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+		acc = _mm512_fmadd_ps(diff, diff, acc);
+	}
+	if (i < n) {
+		__mmask16 mask = tailMask(n - i);
+		__m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i),
+									_mm512_maskz_loadu_ps(mask, b + i));
+		acc = _mm512_fmadd_ps(diff, diff, acc);
+	}
+	return _mm512_reduce_add_ps(acc);
+}
+
+__attribute__((target("avx512f"))) float dotProductHalfAVX512(const float *a, const uint16_t *b,
+																int n) {
+	__m512 acc = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512 bs = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(b + i)));
+		acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), bs, acc);
+	}
+	return _mm512_reduce_add_ps(acc) + dotProductHalfScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f"))) float squaredDistanceHalfAVX512(const uint16_t *a,
+																	 const uint16_t *b, int n) {
+	__m512 acc = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512 as = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(a + i)));
+		__m512 bs = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(b + i)));
+		__m512 diff = _mm512_sub_ps(as, bs);
+		acc = _mm512_fmadd_ps(diff, diff, acc);
+	}
+	return _mm512_reduce_add_ps(acc) + squaredDistanceHalfScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f"))) __m512 loadBytesAVX512(const int8_t *p) {
+	return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)p)));
+}
+
+__attribute__((target("avx512f"))) float dotProductByteAVX512(const float *a, const int8_t *b,
+																int n) {
+	__m512 acc = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), loadBytesAVX512(b + i), acc);
+	}
+	return _mm512_reduce_add_ps(acc) + dotProductByteScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f"))) float squaredDistanceByteAVX512(const int8_t *a, float scaleA,
+																	 const int8_t *b, float scaleB,
+																	 int n) {
+	__m512 acc = _mm512_setzero_ps();
+	__m512 sa = _mm512_set1_ps(scaleA), sb = _mm512_set1_ps(scaleB);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512 diff = _mm512_fmsub_ps(sa, loadBytesAVX512(a + i),
+									  _mm512_mul_ps(sb, loadBytesAVX512(b + i)));
+		acc = _mm512_fmadd_ps(diff, diff, acc);
+	}
+	return _mm512_reduce_add_ps(acc) +
+		   squaredDistanceByteScalar(a + i, scaleA, b + i, scaleB, n - i);
+}
+
+__attribute__((target("avx512f"))) void squaredDistances2x2AVX512(const float *a, const float *b,
+																	 int n, float *out) {
+	__m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps();
+	__m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps();
+	for (int i = 0; i < n; i += 16) {
+		__mmask16 mask = i + 16 <= n ? (__mmask16)0xffff : tailMask(n - i);
+		__m512 a0 = _mm512_maskz_loadu_ps(mask, a + i), a1 = _mm512_maskz_loadu_ps(mask, a + n + i);
+		__m512 b0 = _mm512_maskz_loadu_ps(mask, b + i), b1 = _mm512_maskz_loadu_ps(mask, b + n + i);
+		__m512 d00 = _mm512_sub_ps(a0, b0), d01 = _mm512_sub_ps(a0, b1);
+		__m512 d10 = _mm512_sub_ps(a1, b0), d11 = _mm512_sub_ps(a1, b1);
+		acc00 = _mm512_fmadd_ps(d00, d00, acc00);
+		acc01 = _mm512_fmadd_ps(d01, d01, acc01);
+		acc10 = _mm512_fmadd_ps(d10, d10, acc10);
+		acc11 = _mm512_fmadd_ps(d11, d11, acc11);
+	}
+	out[0] = _mm512_reduce_add_ps(acc00);
+	out[1] = _mm512_reduce_add_ps(acc01);
+	out[2] = _mm512_reduce_add_ps(acc10);
+	out[3] = _mm512_reduce_add_ps(acc11);
+}
+
+__attribute__((target("avx512f"))) void squaredDistances2x2HalfAVX512(const uint16_t *a,
+																		const uint16_t *b, int n,
+																		float *out) {
+	__m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps();
+	__m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512 a0 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(a + i)));
+		__m512 a1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(a + n + i)));
+		__m512 b0 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(b + i)));
+		__m512 b1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(b + n + i)));
+		__m512 d00 = _mm512_sub_ps(a0, b0), d01 = _mm512_sub_ps(a0, b1);
+		__m512 d10 = _mm512_sub_ps(a1, b0), d11 = _mm512_sub_ps(a1, b1);
+		acc00 = _mm512_fmadd_ps(d00, d00, acc00);
+		acc01 = _mm512_fmadd_ps(d01, d01, acc01);
+		acc10 = _mm512_fmadd_ps(d10, d10, acc10);
+		acc11 = _mm512_fmadd_ps(d11, d11, acc11);
+	}
+	out[0] = _mm512_reduce_add_ps(acc00);
+	out[1] = _mm512_reduce_add_ps(acc01);
+	out[2] = _mm512_reduce_add_ps(acc10);
+	out[3] = _mm512_reduce_add_ps(acc11);
+	addDistanceTails(i, n, out, [&](int x, int y, int k) {
+		return halfToFloat(a[x * n + k]) - halfToFloat(b[y * n + k]);
+	});
+}
+
+__attribute__((target("avx512f"))) void squaredDistances2x2ByteAVX512(const int8_t *a,
+																		const float *scalesA,
+																		const int8_t *b,
+																		const float *scalesB,
+																		int n, float *out) {
+	__m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps();
+	__m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps();
+	__m512 sa0 = _mm512_set1_ps(scalesA[0]), sa1 = _mm512_set1_ps(scalesA[1]);
+	__m512 sb0 = _mm512_set1_ps(scalesB[0]), sb1 = _mm512_set1_ps(scalesB[1]);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512 a0 = _mm512_mul_ps(sa0, loadBytesAVX512(a + i));
+		__m512 a1 = _mm512_mul_ps(sa1, loadBytesAVX512(a + n + i));
+		__m512 b0 = _mm512_mul_ps(sb0, loadBytesAVX512(b + i));
+		__m512 b1 = _mm512_mul_ps(sb1, loadBytesAVX512(b + n + i));
+		__m512 d00 = _mm512_sub_ps(a0, b0), d01 = _mm512_sub_ps(a0, b1);
+		__m512 d10 = _mm512_sub_ps(a1, b0), d11 = _mm512_sub_ps(a1, b1);
+		acc00 = _mm512_fmadd_ps(d00, d00, acc00);
+		acc01 = _mm512_fmadd_ps(d01, d01, acc01);
+		acc10 = _mm512_fmadd_ps(d10, d10, acc10);
+		acc11 = _mm512_fmadd_ps(d11, d11, acc11);
+	}
+	out[0] = _mm512_reduce_add_ps(acc00);
+	out[1] = _mm512_reduce_add_ps(acc01);
+	out[2] = _mm512_reduce_add_ps(acc10);
+	out[3] = _mm512_reduce_add_ps(acc11);
+	addDistanceTails(i, n, out, [&](int x, int y, int k) {
+		return scalesA[x] * (float)a[x * n + k] - scalesB[y] * (float)b[y * n + k];
+	});
+}
+
+__attribute__((target("avx512f"))) __m512 expAVX512(__m512 x) {
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_MIN)), _mm512_set1_ps(EXP_MAX));
+	__m512 t = _mm512_fmadd_ps(x, _mm512_set1_ps(LOG2E), _mm512_set1_ps(EXP_ROUNDING_OFFSET));
+	__m512i k = _mm512_sub_epi32(_mm512_cvttps_epi32(t), _mm512_set1_epi32(126));
+	__m512 kf = _mm512_cvtepi32_ps(k);
+	__m512 r = _mm512_fnmadd_ps(kf, _mm512_set1_ps(LN2_HIGH), x);
+	r = _mm512_fnmadd_ps(kf, _mm512_set1_ps(LN2_LOW), r);
+	__m512 p = _mm512_set1_ps(EXP_POLYNOMIAL[0]);
+	rep(i, 1, 6) {
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_POLYNOMIAL[i]));
+	}
+	__m512 y = _mm512_add_ps(_mm512_fmadd_ps(_mm512_mul_ps(r, r), p, r), _mm512_set1_ps(1));
+	__m512i scale = _mm512_slli_epi32(_mm512_add_epi32(k, _mm512_set1_epi32(127)), 23);
+	return _mm512_mul_ps(y, _mm512_castsi512_ps(scale));
+}
+
+__attribute__((target("avx512f"))) void expArrayAVX512(const float *in, float *out, int n) {
+	for (int i = 0; i < n; i += 16) {
+		__mmask16 mask = i + 16 <= n ? (__mmask16)0xffff : tailMask(n - i);
+		_mm512_mask_storeu_ps(out + i, mask, expAVX512(_mm512_maskz_loadu_ps(mask, in + i)));
+	}
+}
+
+__attribute__((target("avx512f"))) void sigmoidArrayAVX512(const float *in, float *out, int n) {
+	__m512 one = _mm512_set1_ps(1);
+	for (int i = 0; i < n; i += 16) {
+		__mmask16 mask = i + 16 <= n ? (__mmask16)0xffff : tailMask(n - i);
+		__m512 x = _mm512_maskz_loadu_ps(mask, in + i);
+		__m512 e = expAVX512(_mm512_sub_ps(_mm512_setzero_ps(), x));
+		_mm512_mask_storeu_ps(out + i, mask, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+	}
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+struct KernelTable {
+	const char *name;
+	float (*dotProduct)(const float *, const float *, int);
+	float (*squaredDistance)(const float *, const float *, int);
+	float (*dotProductHalf)(const float *, const uint16_t *, int);
+	float (*squaredDistanceHalf)(const uint16_t *, const uint16_t *, int);
+	float (*dotProductByte)(const float *, const int8_t *, int);
+	float (*squaredDistanceByte)(const int8_t *, float, const int8_t *, float, int);
+	void (*squaredDistances2x2)(const float *, const float *, int, float *);
+	void (*squaredDistances2x2Half)(const uint16_t *, const uint16_t *, int, float *);
+	void (*squaredDistances2x2Byte)(const int8_t *, const float *, const int8_t *, const float *,
+									int, float *);
+	const char *expName;
+	void (*expArray)(const float *, float *, int);
+	void (*sigmoidArray)(const float *, float *, int);
+};
+
+const KernelTable scalarKernels = {
+	"scalar",
+	dotProductScalar,
+	squaredDistanceScalar,
+	dotProductHalfScalar,
+	squaredDistanceHalfScalar,
+	dotProductByteScalar,
+	squaredDistanceByteScalar,
+	squaredDistances2x2Scalar,
+	squaredDistances2x2HalfScalar,
+	squaredDistances2x2ByteScalar,
+	"polynomial",
+	expArrayScalar,
+	sigmoidArrayScalar,
+};
+
+#ifdef X86_KERNELS
+const KernelTable sseKernels = {
+	"sse",
+	dotProductSSE,
+	squaredDistanceSSE,
+	dotProductHalfScalar,
+	squaredDistanceHalfScalar,
+	dotProductByteScalar,
+	squaredDistanceByteScalar,
+	squaredDistances2x2SSE,
+	squaredDistances2x2HalfScalar,
+	squaredDistances2x2ByteScalar,
+	"polynomial",
+	expArraySSE,
+	sigmoidArraySSE,
+};
+
+const KernelTable avx2Kernels = {
+	"avx2",
+	dotProductAVX2,
+	squaredDistanceAVX2,
+	dotProductHalfAVX2,
+	squaredDistanceHalfAVX2,
+	dotProductByteAVX2,
+	squaredDistanceByteAVX2,
+	squaredDistances2x2AVX2,
+	squaredDistances2x2HalfAVX2,
+	squaredDistances2x2ByteAVX2,
+	"polynomial",
+	expArrayAVX2,
+	sigmoidArrayAVX2,
+};
+
+const KernelTable avx512Kernels = {
+	"avx512",
+	dotProductAVX512,
+	squaredDistanceAVX512,
+	dotProductHalfAVX512,
+	squaredDistanceHalfAVX512,
+	dotProductByteAVX512,
+	squaredDistanceByteAVX512,
+	squaredDistances2x2AVX512,
+	squaredDistances2x2HalfAVX512,
+	squaredDistances2x2ByteAVX512,
+	"polynomial",
+	expArrayAVX512,
+	sigmoidArrayAVX512,
+};
+#endif
+
+KernelTable selectKernels() {
+	vector<const KernelTable *> supported = {&scalarKernels};
+#ifdef X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		supported.push_back(&sseKernels);
+	}
+	// The AVX2 table also converts half precision floats with F16C instructions
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+		__builtin_cpu_supports("f16c")) {
+		supported.push_back(&avx2Kernels);
+	}
+	if (__builtin_cpu_supports("avx512f")) {
+		supported.push_back(&avx512Kernels);
+	}
+#endif
+	// Allow a slower variant to be forced, for comparing results and timings
+	KernelTable selected = *supported.back();
+	const char *forced = getenv("CODENAMES_KERNELS");
+	if (forced != nullptr) {
+		for (const KernelTable *table : supported) {
+			if (table->name == string(forced)) {
+				selected = *table;
+			}
+		}
+	}
+	const char *forcedExp = getenv("CODENAMES_EXP");
+	if (forcedExp != nullptr && forcedExp == string("libm")) {
+		selected.expName = "libm";
+		selected.expArray = expArrayLibm;
+		selected.sigmoidArray = sigmoidArrayLibm;
+	}
+	return selected;
+}
+
+const KernelTable &kernels() {
+	static const KernelTable table = selectKernels();
+	return table;
+}
+
+}  // namespace
+
+const char *kernelVariant() {
+	return kernels().name;
+}
+
+const char *expVariant() {
+	return kernels().expName;
+}
+
+void expArray(const float *in, float *out, int n) {
+	kernels().expArray(in, out, n);
+}
+
+void sigmoidArray(const float *in, float *out, int n) {
+	kernels().sigmoidArray(in, out, n);
+}
+
+float dotProduct(const float *a, const float *b, int n) {
+	return kernels().dotProduct(a, b, n);
+}
+
+float squaredDistance(const float *a, const float *b, int n) {
+	return kernels().squaredDistance(a, b, n);
+}
+
+float dotProductHalf(const float *a, const uint16_t *b, int n) {
+	return kernels().dotProductHalf(a, b, n);
+}
+
+float squaredDistanceHalf(const uint16_t *a, const uint16_t *b, int n) {
+	return kernels().squaredDistanceHalf(a, b, n);
+}
+
+float dotProductByte(const float *a, const int8_t *b, int n) {
+	return kernels().dotProductByte(a, b, n);
+}
+
+float squaredDistanceByte(const int8_t *a, float scaleA, const int8_t *b, float scaleB, int n) {
+	return kernels().squaredDistanceByte(a, scaleA, b, scaleB, n);
+}
+
+void quantizeHalf(const float *in, uint16_t *out, int n) {
+	rep(i, 0, n) {
+		out[i] = floatToHalf(in[i]);
+	}
+}
+
+void dequantizeHalf(const uint16_t *in, float *out, int n) {
+	rep(i, 0, n) {
+		out[i] = halfToFloat(in[i]);
+	}
+}
+
+float quantizeByte(const float *in, int8_t *out, int n) {
+	float maxAbs = 0;
+	rep(i, 0, n) {
+		maxAbs = max(maxAbs, abs(in[i]));
+	}
+	float scale = maxAbs > 0 ? maxAbs / 127 : 1;
+	rep(i, 0, n) {
+		out[i] = (int8_t)lrintf(in[i] / scale);
+	}
+	return scale;
+}
+
+void dequantizeByte(const int8_t *in, float scale, float *out, int n) {
+	rep(i, 0, n) {
+		out[i] = scale * (float)in[i];
+	}
+}
+
+void squaredDistances2x2(const float *a, const float *b, int n, float *out) {
+	kernels().squaredDistances2x2(a, b, n, out);
+}
+
+void squaredDistances2x2Half(const uint16_t *a, const uint16_t *b, int n, float *out) {
+	kernels().squaredDistances2x2Half(a, b, n, out);
+}
+
+void squaredDistances2x2Byte(const int8_t *a, const float *scalesA, const int8_t *b,
+							 const float *scalesB, int n, float *out) {
+	kernels().squaredDistances2x2Byte(a, scalesA, b, scalesB, n, out);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+
+/** Numeric kernels shared by the similarity engines.
+ *
+ * Vectors are plain arrays of n elements. Quantized vectors are stored either as IEEE half
+ * precision floats (fp16), or as bytes that are multiplied by a per-vector scale (int8).
+ *
+ * The similarity kernels exist in scalar, SSE, AVX2 and AVX-512 versions. The fastest one the
+ * CPU supports is picked on first use, so the binaries do not need to be built for the host.
+ * Setting the environment variable CODENAMES_KERNELS to one of the names returned by
+ * #kernelVariant forces a slower version.
+ *
+ * exp and the logistic function are computed for whole arrays with a polynomial approximation:
+ * x is split into k ln 2 + r with |r| <= ln(2) / 2, e^r is evaluated by a degree 7 polynomial and
+ * the result is scaled by 2^k through its exponent bits. Arguments are clamped to [EXP_MIN,
+ * EXP_MAX], which keeps the results finite and normal. Within that range the relative error of
+ * #expArray is below 1.2e-7 (2 ulp), and #sigmoidArray has an absolute error below 1.8e-7 and a
+ * relative one below 2.4e-7 (4 ulp). Setting the environment variable CODENAMES_EXP to "libm"
+ * makes them call std::exp instead, for comparing results; see #expVariant. "bench exp" measures
+ * the errors and the speed against libm.
+ */
+
+/** Name of the kernel version in use: "scalar", "sse", "avx2" or "avx512" */
+const char *kernelVariant();
+
+/** Name of the exp implementation in use: "polynomial" or "libm" */
+const char *expVariant();
+
+const float EXP_MIN = -87.0f;
+const float EXP_MAX = 88.0f;
+
+/** Writes e^in[i] to out[i] for all i < n. in and out may be the same array. */
+void expArray(const float *in, float *out, int n);
+
+/** Writes 1 / (1 + e^-in[i]) to out[i] for all i < n. in and out may be the same array. */
+void sigmoidArray(const float *in, float *out, int n);
+
+float dotProduct(const float *a, const float *b, int n);
+
+/** Inner product of a float vector and an fp16 vector */
+float dotProductHalf(const float *a, const uint16_t *b, int n);
+
+/** Inner product of a float vector and an int8 vector, without the scale of b applied */
+float dotProductByte(const float *a, const int8_t *b, int n);
+
+float squaredDistance(const float *a, const float *b, int n);
+
+float squaredDistanceHalf(const uint16_t *a, const uint16_t *b, int n);
+
+float squaredDistanceByte(const int8_t *a, float scaleA, const int8_t *b, float scaleB, int n);
+
+/** Squared distances between each of the vectors a0 = a and a1 = a + n, and each of the vectors
+ * b0 = b and b1 = b + n, computed in a single pass. Written to out as a0b0, a0b1, a1b0, a1b1. */
+void squaredDistances2x2(const float *a, const float *b, int n, float *out);
+
+void squaredDistances2x2Half(const uint16_t *a, const uint16_t *b, int n, float *out);
+
+/** As #squaredDistances2x2, where vector ai is scaled by scalesA[i] and bi by scalesB[i] */
+void squaredDistances2x2Byte(const int8_t *a, const float *scalesA, const int8_t *b,
+							 const float *scalesB, int n, float *out);
+
+uint16_t floatToHalf(float x);
+
+float halfToFloat(uint16_t h);
+
+void quantizeHalf(const float *in, uint16_t *out, int n);
+
+void dequantizeHalf(const uint16_t *in, float *out, int n);
+
+/** Quantizes the vector to bytes in [-127, 127] and returns the scale to multiply them with */
+float quantizeByte(const float *in, int8_t *out, int n);
+
+void dequantizeByte(const int8_t *in, float scale, float *out, int n);
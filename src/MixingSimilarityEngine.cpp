@@ -31,3 +31,14 @@ float MixingSimilarityEngine::similarity(wordID fixedWord, wordID dynWord) {
 float MixingSimilarityEngine::commutativeSimilarity(wordID word1, wordID word2) {
 	return engine1->commutativeSimilarity(word1, word2) * multiplier1 + engine2->commutativeSimilarity(word1, word2) * multiplier2;
 }
+
+void MixingSimilarityEngine::similarityMatrix(const vector<wordID> &fixedWords,
+											  const wordID *dynWords, int count, float *out) {
+	size_t n = fixedWords.size() * count;
+	vector<float> other(n);
+	engine1->similarityMatrix(fixedWords, dynWords, count, out);
+	engine2->similarityMatrix(fixedWords, dynWords, count, other.data());
+	rep(k, 0, n) {
+		out[k] = out[k] * multiplier1 + other[k] * multiplier2;
+	}
+}
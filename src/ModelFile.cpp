@@ -0,0 +1,207 @@
+#include "ModelFile.h"
+#include "Dictionary.h"
+#include "Kernels.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+#define all(v) (v).begin(), (v).end()
+
+using namespace std;
+
+int vectorTypeSize(VectorType type) {
+	switch (type) {
+		case VectorType::FP16:
+			return 2;
+		case VectorType::INT8:
+			return 1;
+		default:
+			return 4;
+	}
+}
+
+static uint64_t alignSection(uint64_t offset) {
+	const uint64_t a = ModelHeader::SECTION_ALIGNMENT;
+	return (offset + a - 1) / a * a;
+}
+
+ModelFile::~ModelFile() {
+	if (data != nullptr) {
+		munmap((void *)data, size);
+	}
+}
+
+bool ModelFile::open(const string &fileName) {
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd == -1) {
+		cerr << "Failed to open " << fileName << endl;
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ModelHeader)) {
+		cerr << fileName << " is too small to be a model file" << endl;
+		close(fd);
+		return false;
+	}
+	size = (size_t)st.st_size;
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		cerr << "Failed to map " << fileName << endl;
+		size = 0;
+		return false;
+	}
+	data = (const char *)p;
+
+	const ModelHeader &h = header();
+	if (h.sentinel != -1 || h.formatVersion != ModelHeader::VERSION) {
+		cerr << fileName << " is not a version " << ModelHeader::VERSION << " model file" << endl;
+		return false;
+	}
+	if (h.numberOfWords < 0 || h.dimension <= 0 || h.stride < h.dimension ||
+		h.stride % ModelHeader::ROW_ALIGNMENT != 0 ||
+		(h.vectorType != VectorType::FP32 && h.vectorType != VectorType::FP16 &&
+		 h.vectorType != VectorType::INT8)) {
+		cerr << fileName << " has an invalid header" << endl;
+		return false;
+	}
+	uint64_t n = (uint64_t)h.numberOfWords;
+	// Checks that count elements of the given size start at offset and end within the file,
+	// written so that the size of the section cannot overflow
+	auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize) {
+		return offset % ModelHeader::SECTION_ALIGNMENT == 0 && offset <= size &&
+			   count <= (size - offset) / elementSize;
+	};
+	uint64_t rowBytes = (uint64_t)h.stride * vectorTypeSize(h.vectorType);
+	if (!fits(h.vectorsOffset, n, rowBytes) ||
+		(h.vectorType == VectorType::INT8 && !fits(h.scalesOffset, n, sizeof(float))) ||
+		!fits(h.normsOffset, n, sizeof(float)) ||
+		!fits(h.stringOffsetsOffset, n + 1, sizeof(uint32_t)) ||
+		!fits(h.sortedOffset, n, sizeof(uint32_t)) ||
+		!fits(h.stringDataOffset, wordOffsets()[n], 1) ||
+		(h.hashTableSize != 0 && !fits(h.hashTableOffset, h.hashTableSize, sizeof(int32_t)))) {
+		cerr << fileName << " is truncated" << endl;
+		return false;
+	}
+
+	// The words are read without further checks, so every word must lie within the string data
+	const uint32_t *offsets = wordOffsets(), *sorted = section<uint32_t>(h.sortedOffset);
+	rep(i, 0, n) {
+		if (offsets[i] > offsets[i + 1] || sorted[i] >= n) {
+			cerr << fileName << " has an invalid word index" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ModelFile::loadDictionary(Dictionary &dict) const {
+	const ModelHeader &h = header();
+	if (h.hashTableSize == 0 || h.hashTableSize > (uint64_t)INT32_MAX) {
+		return false;
+	}
+	return dict.loadPrebuilt(section<char>(h.stringDataOffset), wordOffsets(), h.numberOfWords,
+							 hashTable(), (int)h.hashTableSize);
+}
+
+bool writeModelFile(const string &fileName, int modelid, int dimension, const vector<string> &words,
+					const vector<float> &norms, const vector<float> &vectors, VectorType vectorType) {
+	int n = (int)words.size();
+	ModelHeader h;
+	memset(&h, 0, sizeof h);
+	h.sentinel = -1;
+	h.formatVersion = ModelHeader::VERSION;
+	h.modelid = modelid;
+	h.numberOfWords = n;
+	h.dimension = dimension;
+	h.stride = (dimension + ModelHeader::ROW_ALIGNMENT - 1) / ModelHeader::ROW_ALIGNMENT *
+			   ModelHeader::ROW_ALIGNMENT;
+	h.vectorType = vectorType;
+
+	vector<uint32_t> offsets(n + 1);
+	rep(i, 0, n) {
+		offsets[i + 1] = offsets[i] + (uint32_t)words[i].size();
+	}
+	vector<uint32_t> sorted(n);
+	iota(all(sorted), 0);
+	sort(all(sorted), [&](uint32_t a, uint32_t b) { return words[a] < words[b]; });
+	vector<int32_t> table = Dictionary::buildTable(words);
+	bool distinct = true;
+	rep(i, 0, n - 1) {
+		distinct = distinct && words[sorted[i]] != words[sorted[i + 1]];
+	}
+
+	h.vectorsOffset = alignSection(sizeof h);
+	uint64_t rowBytes = (uint64_t)h.stride * vectorTypeSize(vectorType);
+	h.normsOffset = alignSection(h.vectorsOffset + n * rowBytes);
+	h.stringOffsetsOffset = alignSection(h.normsOffset + (uint64_t)n * sizeof(float));
+	h.sortedOffset = alignSection(h.stringOffsetsOffset + (uint64_t)(n + 1) * sizeof(uint32_t));
+	h.stringDataOffset = alignSection(h.sortedOffset + (uint64_t)n * sizeof(uint32_t));
+	uint64_t end = h.stringDataOffset + offsets[n];
+	if (vectorType == VectorType::INT8) {
+		h.scalesOffset = alignSection(end);
+		end = h.scalesOffset + (uint64_t)n * sizeof(float);
+	}
+	if (distinct) {
+		h.hashTableOffset = alignSection(end);
+		h.hashTableSize = table.size();
+	}
+
+	ofstream fout(fileName, ios::binary);
+	auto seek = [&](uint64_t offset) {
+		static const char zeros[ModelHeader::SECTION_ALIGNMENT] = {};
+		uint64_t pos = (uint64_t)fout.tellp();
+		fout.write(zeros, (streamsize)(offset - pos));
+	};
+	fout.write((const char *)&h, sizeof h);
+	seek(h.vectorsOffset);
+	vector<float> row(h.stride);
+	vector<uint16_t> halfRow(h.stride);
+	vector<int8_t> byteRow(h.stride);
+	vector<float> scales;
+	rep(i, 0, n) {
+		copy(vectors.begin() + (size_t)i * dimension, vectors.begin() + (size_t)(i + 1) * dimension,
+			 row.begin());
+		if (vectorType == VectorType::FP16) {
+			quantizeHalf(row.data(), halfRow.data(), h.stride);
+			fout.write((const char *)halfRow.data(), rowBytes);
+		} else if (vectorType == VectorType::INT8) {
+			scales.push_back(quantizeByte(row.data(), byteRow.data(), h.stride));
+			fout.write((const char *)byteRow.data(), rowBytes);
+		} else {
+			fout.write((const char *)row.data(), rowBytes);
+		}
+	}
+	seek(h.normsOffset);
+	fout.write((const char *)norms.data(), n * sizeof(float));
+	seek(h.stringOffsetsOffset);
+	fout.write((const char *)offsets.data(), (n + 1) * sizeof(uint32_t));
+	seek(h.sortedOffset);
+	fout.write((const char *)sorted.data(), n * sizeof(uint32_t));
+	seek(h.stringDataOffset);
+	rep(i, 0, n) {
+		fout.write(words[i].data(), words[i].size());
+	}
+	if (vectorType == VectorType::INT8) {
+		seek(h.scalesOffset);
+		fout.write((const char *)scales.data(), n * sizeof(float));
+	}
+	if (distinct) {
+		seek(h.hashTableOffset);
+		fout.write((const char *)table.data(), table.size() * sizeof(int32_t));
+	}
+	fout.close();
+	if (!fout) {
+		cerr << "Failed to write " << fileName << endl;
+		return false;
+	}
+	return true;
+}
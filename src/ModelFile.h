@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Dictionary;
+
+/** Element type of the vectors of a model */
+enum class VectorType : int32_t {
+	FP32 = 0,
+	// IEEE half precision floats
+	FP16 = 1,
+	// Bytes in [-127, 127], multiplied by a scale per row
+	INT8 = 2,
+};
+
+/** Size in bytes of a single vector element of the given type */
+int vectorTypeSize(VectorType type);
+
+/** Header of a version 2 model file.
+ *
+ * The first five fields coincide with the header of the version 1 format, so loaders can tell
+ * the formats apart by formatVersion. The header is followed by a number of sections, each
+ * starting at a 64-byte aligned offset from the beginning of the file, so that the whole file can
+ * be memory-mapped and used in place.
+ */
+struct ModelHeader {
+	int32_t sentinel;  // Always -1
+	int32_t formatVersion;
+	int32_t modelid;
+	int32_t numberOfWords;
+	int32_t dimension;
+
+	// Number of elements per row of the vector block, a multiple of ROW_ALIGNMENT
+	int32_t stride;
+	VectorType vectorType;
+	int32_t reserved0;
+
+	// numberOfWords rows of stride elements of type vectorType, each holding a normalized word
+	// vector padded with zeros
+	uint64_t vectorsOffset;
+
+	// numberOfWords floats, the squared norms of the original word vectors
+	uint64_t normsOffset;
+
+	// numberOfWords + 1 uint32 offsets into the string data; word i spans [offsets[i], offsets[i+1])
+	uint64_t stringOffsetsOffset;
+
+	// The words, concatenated without separators
+	uint64_t stringDataOffset;
+
+	// numberOfWords uint32 row indices, ordered so that the corresponding words are sorted
+	uint64_t sortedOffset;
+
+	// numberOfWords floats, the scale of each row if vectorType is INT8, otherwise 0
+	uint64_t scalesOffset;
+
+	// hashTableSize int32 slots of the Dictionary hash table over the words, with word i having
+	// ID i. hashTableSize is 0 if the file has no table, e.g. because a word occurs twice.
+	uint64_t hashTableOffset;
+	uint64_t hashTableSize;
+
+	uint64_t reserved[4];
+
+	static const int VERSION = 2;
+	static const int ROW_ALIGNMENT = 16;
+	static const int SECTION_ALIGNMENT = 64;
+};
+
+static_assert(sizeof(ModelHeader) == 128, "ModelHeader must have a fixed layout");
+
+/** A read-only memory mapping of a version 2 model file. The mapping is shared with all other
+ * processes that have the same file open, so they also share its pages in the page cache. */
+struct ModelFile {
+   private:
+	const char *data = nullptr;
+	size_t size = 0;
+
+	template <class T>
+	const T *section(uint64_t offset) const {
+		return (const T *)(data + offset);
+	}
+
+   public:
+	ModelFile() {}
+	ModelFile(const ModelFile &) = delete;
+	ModelFile &operator=(const ModelFile &) = delete;
+	~ModelFile();
+
+	/** Maps the file into memory and validates its header, section bounds and word index.
+	 * Returns true if successful */
+	bool open(const std::string &fileName);
+
+	inline const ModelHeader &header() const {
+		return *section<ModelHeader>(0);
+	}
+
+	/** The vector block, if the vector type is FP32 */
+	inline const float *vectors() const {
+		return section<float>(header().vectorsOffset);
+	}
+
+	/** The vector block, for any vector type */
+	inline const void *vectorData() const {
+		return section<char>(header().vectorsOffset);
+	}
+
+	/** Row scales if the vector type is INT8 */
+	inline const float *scales() const {
+		return section<float>(header().scalesOffset);
+	}
+
+	inline const float *norms() const {
+		return section<float>(header().normsOffset);
+	}
+
+	inline const char *wordData(int index) const {
+		return section<char>(header().stringDataOffset) + wordOffsets()[index];
+	}
+
+	inline int wordLength(int index) const {
+		return (int)(wordOffsets()[index + 1] - wordOffsets()[index]);
+	}
+
+	inline const uint32_t *wordOffsets() const {
+		return section<uint32_t>(header().stringOffsetsOffset);
+	}
+
+	inline std::string_view word(int index) const {
+		return std::string_view(wordData(index), wordLength(index));
+	}
+
+	/** The prebuilt dictionary hash table, see ModelHeader::hashTableOffset */
+	inline const int32_t *hashTable() const {
+		return section<int32_t>(header().hashTableOffset);
+	}
+
+	/** Fills an empty dictionary with the words of the file using the prebuilt hash table, so
+	 * the ID of every word is its row. Returns false if the dictionary is not empty or the file
+	 * has no table. */
+	bool loadDictionary(Dictionary &dict) const;
+};
+
+/** Writes a version 2 model file.
+ * vectors holds words.size() rows of dimension floats each; they are quantized to vectorType and
+ * padded to the row stride of the file. Returns true if successful.
+ */
+bool writeModelFile(const std::string &fileName, int modelid, int dimension,
+					const std::vector<std::string> &words, const std::vector<float> &norms,
+					const std::vector<float> &vectors,
+					VectorType vectorType = VectorType::FP32);
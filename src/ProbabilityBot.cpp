@@ -1,10 +1,12 @@
 #include "ProbabilityBot.h"
+#include "Kernels.h"
+#include "TopK.h"
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <functional>
 #include <iostream>
 #include <map>
-#include <queue>
-#include <random>
 
 #define rep(i, a, b) for (int i = (a); i < int(b); ++i)
 #define trav(x, v) for (auto &x : v)
@@ -16,15 +18,33 @@ void ProbabilityBot::setDifficulty(Difficulty difficulty) {
 	vocabularySize = 30000;
 }
 
+vector<wordID> ProbabilityBot::boardWordIDs() const {
+	vector<wordID> ret;
+	trav(w, boardWords) ret.push_back(w.id);
+	return ret;
+}
+
 float ProbabilityBot::getWordScore(wordID word) {
+	vector<float> similarities(boardWords.size());
+	engine.similarityMatrix(boardWordIDs(), &word, 1, similarities.data());
+	return getWordScore(word, similarities.data());
+}
+
+float ProbabilityBot::getWordScore(wordID /*word*/, const float *similarities) {
 	int myWordsLeft = 0, opponentWordsLeft = 0;
 
 	// Iterate through all words and check how similar the word is to every word on the board.
 	// Add some bonuses to account for the colors of the words.
+	static thread_local vector<float> weights;
+	weights.resize(boardWords.size());
+	rep(i, 0, boardWords.size()) {
+		weights[i] = 3 * similarities[i];
+	}
+	expArray(weights.data(), weights.data(), (int)weights.size());
+
 	float totalWeight = 0;
 	float totalScore = 0;
 	rep(i, 0, boardWords.size()) {
-		float sim = engine.similarity(boardWords[i].id, word);
 		float value = 0;
 		if (boardWords[i].type == CardType::CIVILIAN) {
 			value = 0;
@@ -36,7 +56,7 @@ float ProbabilityBot::getWordScore(wordID word) {
 			value = 1;
 		}
 
-		float weight = exp(3*sim);
+		float weight = weights[i];
 		totalWeight += weight;
 		totalScore += weight * value;
 	}
@@ -64,107 +84,162 @@ float ProbabilityBot::getWordScore(wordID word) {
 }
 
 float ProbabilityBot::getProbabilityScore(wordID word, int number) {
-	vector<float> score(boardWords.size());
-	for(size_t i = 0; i < boardWords.size(); i++) {
-		score[i] = engine.similarity(boardWords[i].id, word) - 0.15;
+	vector<float> similarities(boardWords.size());
+	engine.exactSimilarityMatrix(boardWordIDs(), &word, 1, similarities.data());
+	simulator.prepare((int)boardWords.size());
+	return getProbabilityScore(similarities.data(), number);
+}
+
+float ProbabilityBot::getProbabilityScore(const float *similarities, int number) const {
+	return simulator.expectedScore(boardWords, similarities, number);
+}
+
+/** The value that a standard normal variable is below with the given probability */
+static double normalQuantile(double p) {
+	double low = -10, high = 10;
+	rep(iteration, 0, 100) {
+		double mid = (low + high) / 2;
+		if (0.5 * erfc(-mid / sqrt(2.0)) < p) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return (low + high) / 2;
+}
+
+vector<GuessSimulator::Tally> ProbabilityBot::raceClues(const vector<float> &similarities,
+														int keep) {
+	int clues = (int)similarities.size() / max((int)boardWords.size(), 1);
+	vector<GuessSimulator::Tally> tallies(clues);
+	simulator.prepare((int)boardWords.size());
+	int groups = simulator.groupCount();
+	auto simulate = [&](const vector<int> &which, int first, int count) {
+		parallelFor((int)which.size(), numThreads, [&](int index, int) {
+			int clue = which[index];
+			simulator.simulate(boardWords, &similarities[clue * boardWords.size()], MAX_NUMBER,
+							   first, count, tallies[clue]);
+		});
+	};
+	vector<int> alive(clues);
+	rep(i, 0, clues) {
+		alive[i] = i;
 	}
-	vector<float> scoreWithNoise(boardWords.size());
-	size_t simulations = 1000;
-	double totScore = 0;
-	vector<bool> remaining(boardWords.size());
-	normal_distribution<double> distribution(0.0, 0.24 * 0.5);
-	uniform_real_distribution<double> distribution01(0.0, 1.0);
-	default_random_engine generator;
-
-	for (size_t i = 0; i < simulations; i++) {
-		for (size_t j = 0; j < boardWords.size(); j++) {
-			double p = (2-score[j]) * score[j] + 0.05;
-			remaining[j] = p >= distribution01(generator);
-			//remaining[j] = true;
+	if (simulationBudget <= 0 || clues <= keep) {
+		simulate(alive, 0, groups);
+		return tallies;
+	}
+
+	// Successive halving: every round gets an equal part of the budget, which is shared by the
+	// clues that are left. With half as many clues as the round before, each of them would get
+	// twice as many simulations.
+	int rounds = 1;
+	while ((keep << (rounds - 1)) < clues) {
+		rounds++;
+	}
+	long long budget = max(simulationBudget / GuessSimulator::LANES, (long long)clues);
+	long long spent = 0;
+	int done = 0;
+	double z = normalQuantile(raceConfidence);
+	rep(round, 0, rounds) {
+		long long share = (budget - spent) / (rounds - round) / (long long)alive.size();
+		int count = (int)min(max(share, 1LL), (long long)(groups - done));
+		if (count <= 0) {
+			break;
 		}
-		//cerr << "Simulation " << (i+1) << endl;
-		for (size_t j = 0; j < boardWords.size(); j++) {
-			scoreWithNoise[j] = score[j] + distribution(generator);
-			//cerr << boardWords[j].word << " " << score[j] << " " << scoreWithNoise[j] << endl;
+		simulate(alive, done, count);
+		done += count;
+		spent += (long long)count * alive.size();
+		if ((int)alive.size() <= keep) {
+			continue;
 		}
-		double simulationScore = 0;
-		for (int j = 0; j < number; j++) {
-			int chosen = -1;
-			for (size_t k = 0; k < boardWords.size(); k++) {
-				if (remaining[k]) {
-					if (chosen == -1 || scoreWithNoise[k] > scoreWithNoise[chosen]) {
-						chosen = k;
-					}
-				}
-			}
 
-			if (chosen == -1) break;
-
-			//cerr << "Chose " << boardWords[chosen].word << endl;
-			remaining[chosen] = false;
-			if (boardWords[chosen].type == CardType::CIVILIAN) {
-				break;
-			}
-			if (boardWords[chosen].type == CardType::OPPONENT) {
-				simulationScore -= 1;
-				break;
-			}
-			if (boardWords[chosen].type == CardType::ASSASSIN) {
-				simulationScore -= 3;
-				break;
+		// Drop the clues whose score is probably below the keep-th best one
+		vector<double> lower, upper;
+		trav(clue, alive) {
+			const GuessSimulator::Tally &tally = tallies[clue];
+			int best = 1;
+			rep(num, 2, MAX_NUMBER + 1) {
+				if (tally.mean(num) > tally.mean(best)) {
+					best = num;
+				}
 			}
-			if (boardWords[chosen].type == CardType::MINE) {
-				simulationScore += 1;
+			lower.push_back(tally.mean(best) - z * tally.standardError(best));
+			upper.push_back(tally.mean(best) + z * tally.standardError(best));
+		}
+		vector<double> sortedLower = lower;
+		nth_element(sortedLower.begin(), sortedLower.begin() + (keep - 1), sortedLower.end(),
+					greater<double>());
+		double threshold = sortedLower[keep - 1];
+		vector<int> contenders;
+		rep(i, 0, alive.size()) {
+			if (upper[i] >= threshold) {
+				contenders.push_back(alive[i]);
 			}
 		}
-		totScore += simulationScore;
+		alive = contenders;
 	}
-	return totScore / simulations;
+	return tallies;
 }
 
 vector<Bot::Result> ProbabilityBot::findBestWords(int count) {
 	vector<wordID> candidates = dict.getCommonWords(vocabularySize);
-	priority_queue<pair<float, wordID>> pq;
-
+	// The clues to simulate, by score and then by the larger ID
+	TopK<pair<float, wordID>> best(SIMULATED_CLUES);
 
-	for (auto candidate : candidates) {
-		pq.push(make_pair(getWordScore(candidate), candidate));
+	vector<wordID> fixedWords = boardWordIDs();
+	vector<float> similarities((size_t)SCAN_BLOCK_SIZE * fixedWords.size());
+	similarityCache.update(engine, candidates, fixedWords, numThreads);
+	markForbiddenWords((int)candidates.size());
+	rep(index, 0, candidates.size()) {
+		int offset = index % SCAN_BLOCK_SIZE;
+		if (offset == 0) {
+			int blockSize = min((int)candidates.size() - index, SCAN_BLOCK_SIZE);
+			similarityCache.gather(index, blockSize, similarities.data());
+		}
+		wordID candidate = candidates[index];
+		if (isForbidden(candidate)) {
+			continue;
+		}
+		float score = getWordScore(candidate, &similarities[(size_t)offset * fixedWords.size()]);
+		best.push(make_pair(score, candidate));
 	}
+	lastScanStats.candidates = (int)candidates.size();
+	lastScanStats.pruned = 0;
 
 
 	vector<wordID> subset;
-	while (subset.size() < 500 && !pq.empty()) {
-		auto item = pq.top();
-		if (!forbiddenWord(dict.getWord(item.second))) {
-			subset.push_back(item.second);
-			//cout << item.first << " " << dict.getWord(item.second) << endl;
-		}
-
-		pq.pop();
+	trav(entry, best.sorted()) {
+		subset.push_back(entry.second);
 	}
 
+	// Simulate the guesses for the clues in the subset
+	vector<float> exact(subset.size() * fixedWords.size());
+	engine.exactSimilarityMatrix(fixedWords, subset.data(), (int)subset.size(), exact.data());
+	int resultCount = min(10, (int)subset.size());
+	vector<GuessSimulator::Tally> tallies = raceClues(exact, resultCount);
 	vector<pair<pair<float, int>, wordID>> simulationScores;
-	for (auto clue : subset) {
+	rep(index, 0, subset.size()) {
 		float bestScore = -10000;
 		int bestNum = 0;
-		for (int num = 1; num <= 9; num++) {
-			float score = getProbabilityScore(clue, num);
+		for (int num = 1; num <= MAX_NUMBER; num++) {
+			float score = (float)tallies[index].mean(num);
 			if (score > bestScore) {
 				bestScore = score;
 				bestNum = num;
 			}
 		}
 
-		simulationScores.push_back(make_pair(make_pair(bestScore, bestNum), clue));
+		simulationScores.push_back(make_pair(make_pair(bestScore, bestNum), subset[index]));
 	}
 
 	sort(simulationScores.rbegin(), simulationScores.rend());
 
 	vector<Bot::Result> results;
-	for (size_t i = 0; i < 10; i++) {
+	rep(i, 0, resultCount) {
 		auto item = simulationScores[i];
 		Result result;
-		result.word = dict.getWord(item.second);
+		result.word = string(dict.getWord(item.second));
 		result.number = item.first.second;
 		result.score = item.first.first;
 		for (auto word : boardWords) {
@@ -2,6 +2,7 @@
 
 #include "Bot.h"
 #include "Dictionary.h"
+#include "GuessSimulator.h"
 #include "InappropriateEngine.h"
 #include "SimilarityEngine.h"
 #include "Utilities.h"
@@ -11,6 +12,12 @@
 #include <vector>
 
 struct ProbabilityBot : Bot {
+	// Highest number that is considered for a clue
+	static const int MAX_NUMBER = 9;
+
+	// Number of best scoring candidates whose guesses are simulated
+	static const int SIMULATED_CLUES = 500;
+
 	// Number of words that are considered common
 	int commonWordLimit;
 
@@ -39,11 +46,22 @@ struct ProbabilityBot : Bot {
 	float singleWordPenalty;
 
 	// A set of strings for which the bot has already provided clues
-	std::set<std::string> hasInfoAbout;
+	std::set<std::string, std::less<>> hasInfoAbout;
 
 	// A list of all clues that have already been given to the team
 	std::vector<wordID> oldClues;
 
+	// Estimates how well the team will do after a clue
+	GuessSimulator simulator;
+
+	// Number of simulations to spend on all shortlisted clues together. The clues are raced:
+	// simulations are handed out in rounds, and after each round the clues that are clearly worse
+	// than the best ones are dropped. 0 simulates every clue simulator.simulations times.
+	long long simulationBudget = 50000;
+
+	// Confidence level of the intervals that decide when a clue is dropped from the race
+	double raceConfidence = 0.99;
+
 	ProbabilityBot(Dictionary &dict, SimilarityEngine &engine, InappropriateEngine &inappropriateEngine)
 		: Bot(dict, engine, inappropriateEngine) {
 		setDifficulty(Difficulty::EASY);
@@ -51,10 +69,25 @@ struct ProbabilityBot : Bot {
 
 	void setDifficulty(Difficulty difficulty);
 
+	std::vector<wordID> boardWordIDs() const;
+
 	float getWordScore(wordID word);
 
+	/** Like the above, but with the similarities between the board words and the word
+	 * precomputed, in board order */
+	float getWordScore(wordID word, const float *similarities);
+
 	float getProbabilityScore(wordID word, int number);
 
+	/** Like the above, but with the exact similarities between the board words and the word
+	 * precomputed, in board order. Requires simulator.prepare to have been called for the
+	 * current board. */
+	float getProbabilityScore(const float *similarities, int number) const;
+
+	/** Simulates the clues, whose exact similarities to the board words are stored one row per
+	 * clue, within #simulationBudget. keep is the number of clues that must survive the race. */
+	std::vector<GuessSimulator::Tally> raceClues(const std::vector<float> &similarities, int keep);
+
 	std::vector<Result> findBestWords(int count = 20);
 
 	void setHasInfo(std::string word);
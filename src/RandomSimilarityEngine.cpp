@@ -31,3 +31,11 @@ float RandomSimilarityEngine::commutativeSimilarity(wordID word1, wordID word2)
 float RandomSimilarityEngine::similarity(wordID fixedWord, wordID dynWord) {
 	return commutativeSimilarity(fixedWord, dynWord);
 }
+
+void RandomSimilarityEngine::similarityMatrix(const vector<wordID> &fixedWords,
+											  const wordID * /*dynWords*/, int count, float *out) {
+	size_t n = fixedWords.size() * count;
+	rep(k, 0, n) {
+		out[k] = rand() / (float)RAND_MAX;
+	}
+}
@@ -20,6 +20,8 @@ struct RandomSimilarityEngine final : SimilarityEngine {
 	bool load(const std::string &fileName, bool verbose);
 
 	float similarity(wordID fixedWord, wordID dynWord);
+	void similarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords, int count,
+						  float *out);
 	float commutativeSimilarity(wordID word1, wordID word2);
 
 	/** True if the word2vec model includes a vector for the specified word */
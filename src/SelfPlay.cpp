@@ -0,0 +1,231 @@
+#include "SelfPlay.h"
+#include "FuzzyBot.h"
+#include "ProbabilityBot.h"
+#include "Utilities.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <random>
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+#define trav(x, v) for (auto &x : v)
+#define all(v) (v).begin(), (v).end()
+
+using namespace std;
+
+namespace {
+
+// Owners of the cards besides the two teams
+const int CIVILIAN = 2, ASSASSIN = 3;
+
+// Number of words of the team that starts, of the other team and of civilians
+const int STARTER_WORDS = 9, SECOND_WORDS = 8, CIVILIAN_WORDS = 7;
+
+const pair<Bot::Difficulty, const char *> DIFFICULTY_NAMES[] = {
+	{Bot::Difficulty::EASY, "easy"},
+	{Bot::Difficulty::MEDIUM, "medium"},
+	{Bot::Difficulty::HARD, "hard"},
+};
+
+struct Card {
+	string word;
+	wordID id;
+	int owner;
+	bool revealed = false;
+};
+
+}  // namespace
+
+string SelfPlay::Spymaster::name() const {
+	string res = kind == Kind::PROBABILITY ? "probability" : "fuzzy";
+	trav(entry, DIFFICULTY_NAMES) {
+		if (entry.first == difficulty) {
+			res += string("-") + entry.second;
+		}
+	}
+	return res;
+}
+
+bool SelfPlay::Spymaster::parse(const string &name, Spymaster &spymaster) {
+	size_t dash = name.find('-');
+	if (dash == string::npos) {
+		return false;
+	}
+	string kind = name.substr(0, dash), difficulty = name.substr(dash + 1);
+	if (kind == "fuzzy") {
+		spymaster.kind = Kind::FUZZY;
+	} else if (kind == "probability") {
+		spymaster.kind = Kind::PROBABILITY;
+	} else {
+		return false;
+	}
+	trav(entry, DIFFICULTY_NAMES) {
+		if (difficulty == entry.second) {
+			spymaster.difficulty = entry.first;
+			return true;
+		}
+	}
+	return false;
+}
+
+void SelfPlay::Report::add(const GameResult &result) {
+	games++;
+	turns += result.turns;
+	if (result.winner == -1) {
+		draws++;
+		return;
+	}
+	wins[result.winner]++;
+	if (result.assassin) {
+		assassinLosses[result.winner ^ 1]++;
+	}
+}
+
+bool SelfPlay::loadWords(const string &fileName) {
+	ifstream fin(fileName);
+	if (!fin) {
+		return false;
+	}
+	words.clear();
+	string line;
+	while (getline(fin, line)) {
+		while (!line.empty() && isspace((unsigned char)line.back())) {
+			line.pop_back();
+		}
+		if (!line.empty()) {
+			words.push_back(normalize(line));
+		}
+	}
+	return true;
+}
+
+bool SelfPlay::prepare() {
+	usableWords.clear();
+	trav(word, words) {
+		if (engine.wordExists(word) && guesserEngine.wordExists(word)) {
+			usableWords.push_back(word);
+		}
+	}
+	sort(all(usableWords));
+	usableWords.erase(unique(all(usableWords)), usableWords.end());
+	return (int)usableWords.size() >= BOARD_SIZE;
+}
+
+unique_ptr<Bot> SelfPlay::createBot(int team) {
+	unique_ptr<Bot> bot;
+	if (spymasters[team].kind == Spymaster::Kind::PROBABILITY) {
+		bot.reset(new ProbabilityBot(dict, engine, inappropriateEngine));
+	} else {
+		bot.reset(new FuzzyBot(dict, engine, inappropriateEngine));
+	}
+	bot->setDifficulty(spymasters[team].difficulty);
+	bot->numThreads = 1;
+	bot->substringIndex = substringIndex;
+	return bot;
+}
+
+SelfPlay::GameResult SelfPlay::playGame(int game) {
+	seed_seq sequence{(uint32_t)seed, (uint32_t)(seed >> 32), (uint32_t)game};
+	mt19937_64 rng(sequence);
+
+	// Draw the words with a partial Fisher-Yates shuffle, then deal them out
+	vector<int> order(usableWords.size());
+	rep(i, 0, order.size()) {
+		order[i] = i;
+	}
+	int starter = game % 2;
+	vector<int> owners;
+	owners.insert(owners.end(), STARTER_WORDS, starter);
+	owners.insert(owners.end(), SECOND_WORDS, starter ^ 1);
+	owners.insert(owners.end(), CIVILIAN_WORDS, CIVILIAN);
+	owners.resize(BOARD_SIZE, ASSASSIN);
+	vector<Card> cards(BOARD_SIZE);
+	rep(i, 0, BOARD_SIZE) {
+		swap(order[i], order[uniform_int_distribution<int>(i, (int)order.size() - 1)(rng)]);
+		cards[i].word = usableWords[order[i]];
+		cards[i].id = dict.getID(cards[i].word);
+	}
+	shuffle(all(owners), rng);
+	int wordsLeft[2] = {0, 0};
+	rep(i, 0, BOARD_SIZE) {
+		cards[i].owner = owners[i];
+		if (owners[i] < 2) {
+			wordsLeft[owners[i]]++;
+		}
+	}
+
+	unique_ptr<Bot> bots[2] = {createBot(0), createBot(1)};
+	normal_distribution<float> noiseDistribution(0, 1);
+	GameResult result;
+	for (int team = starter; result.turns < MAX_TURNS; team ^= 1) {
+		result.turns++;
+		vector<string> mine, opponent, civilians, assassins;
+		trav(card, cards) {
+			if (card.revealed) {
+				continue;
+			}
+			if (card.owner == team) {
+				mine.push_back(card.word);
+			} else if (card.owner == (team ^ 1)) {
+				opponent.push_back(card.word);
+			} else if (card.owner == CIVILIAN) {
+				civilians.push_back(card.word);
+			} else {
+				assassins.push_back(card.word);
+			}
+		}
+		Bot &bot = *bots[team];
+		bot.setWords(mine, opponent, civilians, assassins);
+		vector<Bot::Result> clues = bot.findBestWords(1);
+		if (clues.empty()) {
+			continue;
+		}
+		const Bot::Result &clue = clues[0];
+		bot.addOldClue(clue.word);
+		if (!guesserEngine.wordExists(clue.word)) {
+			continue;
+		}
+
+		wordID clueID = dict.getID(clue.word);
+		vector<pair<float, int>> guesses;
+		rep(i, 0, BOARD_SIZE) {
+			if (!cards[i].revealed) {
+				float similarity = guesserEngine.similarity(clueID, cards[i].id);
+				guesses.push_back({similarity + noise * noiseDistribution(rng), i});
+			}
+		}
+		sort(all(guesses), greater<pair<float, int>>());
+		rep(guess, 0, min(clue.number, (int)guesses.size())) {
+			Card &card = cards[guesses[guess].second];
+			card.revealed = true;
+			if (card.owner == ASSASSIN) {
+				result.winner = team ^ 1;
+				result.assassin = true;
+				return result;
+			}
+			if (card.owner < 2 && --wordsLeft[card.owner] == 0) {
+				result.winner = card.owner;
+				return result;
+			}
+			if (card.owner != team) {
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+SelfPlay::Report SelfPlay::run(int count) {
+	typedef chrono::steady_clock Clock;
+	vector<GameResult> results(count);
+	auto start = Clock::now();
+	parallelFor(count, numThreads, [&](int game, int) { results[game] = playGame(game); });
+	Report report;
+	report.seconds = chrono::duration<double>(Clock::now() - start).count();
+	trav(result, results) {
+		report.add(result);
+	}
+	return report;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Bot.h"
+#include "Dictionary.h"
+#include "InappropriateEngine.h"
+#include "SimilarityEngine.h"
+#include "SubstringIndex.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** Plays whole games of Codenames between two teams, red (0) and blue (1), each with a bot as
+ * spymaster and a simulated guesser, to measure bots by how often they win.
+ *
+ * A board has 25 words drawn from #words: 9 for the team that starts, 8 for the other team, 7
+ * civilians and the assassin. Red starts the even numbered games and blue the odd ones. In a turn
+ * the spymaster gives the first clue of Bot::findBestWords, and the guesser orders the unrevealed
+ * words by their similarity to the clue in #guesserEngine plus normally distributed noise and
+ * reveals them in that order, up to the number of the clue. The turn ends early when a word does
+ * not belong to the team. A team wins when all its words are revealed (also by the other team)
+ * and loses when it reveals the assassin.
+ *
+ * All random choices of a game come from a generator seeded with (#seed, game number), and the
+ * clues of the bots do not depend on their number of threads, so every game has the same outcome
+ * whichever thread plays it and however many games are played in parallel.
+ */
+struct SelfPlay {
+	static const int BOARD_SIZE = 25;
+
+	// Games that have not ended after this many turns are counted as draws. They only happen if
+	// the spymasters run out of clues, since every clue reveals at least one word.
+	static const int MAX_TURNS = 50;
+
+	/** The kind and settings of the bot that gives the clues of a team */
+	struct Spymaster {
+		enum class Kind { FUZZY, PROBABILITY };
+
+		Kind kind = Kind::FUZZY;
+		Bot::Difficulty difficulty = Bot::Difficulty::MEDIUM;
+
+		/** Name like "fuzzy-medium" or "probability-hard" */
+		std::string name() const;
+
+		/** Parses a name as returned by #name. Returns true if successful. */
+		static bool parse(const std::string &name, Spymaster &spymaster);
+	};
+
+	struct GameResult {
+		// Team that won, or -1 for a draw
+		int winner = -1;
+
+		// True if the game ended because the loser revealed the assassin
+		bool assassin = false;
+
+		// Number of turns played by both teams together
+		int turns = 0;
+	};
+
+	struct Report {
+		int games = 0, draws = 0;
+
+		// Per team
+		int wins[2] = {0, 0};
+		int assassinLosses[2] = {0, 0};
+
+		long long turns = 0;
+
+		// Wall time of all games
+		double seconds = 0;
+
+		void add(const GameResult &result);
+	};
+
+	Dictionary &dict;
+	SimilarityEngine &engine;
+	InappropriateEngine &inappropriateEngine;
+
+	// Engine of the simulated guessers. It may differ from the one of the spymasters, but must
+	// use the same dictionary.
+	SimilarityEngine &guesserEngine;
+
+	// Shared by all bots (see Bot::substringIndex)
+	std::shared_ptr<const SubstringIndex> substringIndex;
+
+	Spymaster spymasters[2];
+
+	// Words that boards are drawn from. Words that either engine does not know are skipped.
+	std::vector<std::string> words;
+
+	// Standard deviation of the noise added to the similarities before ordering the guesses
+	float noise = 0.12f;
+
+	uint64_t seed = 0;
+
+	// Number of games that are played at the same time, 0 means one per hardware thread. Every
+	// bot uses a single thread.
+	int numThreads = 0;
+
+	SelfPlay(Dictionary &dict, SimilarityEngine &engine, InappropriateEngine &inappropriateEngine,
+			 SimilarityEngine &guesserEngine)
+		: dict(dict),
+		  engine(engine),
+		  inappropriateEngine(inappropriateEngine),
+		  guesserEngine(guesserEngine) {}
+
+	/** Reads #words from a file with one word per line. Returns true if successful. */
+	bool loadWords(const std::string &fileName);
+
+	/** Picks the words of #words that both engines know. Must be called after changing #words
+	 * and before playing. Returns false if there are too few of them for a board. */
+	bool prepare();
+
+	/** Plays the game with the given number. Safe to call from several threads. */
+	GameResult playGame(int game);
+
+	/** Plays games 0 to count-1 on #numThreads threads */
+	Report run(int count);
+
+   private:
+	std::vector<std::string> usableWords;
+
+	std::unique_ptr<Bot> createBot(int team);
+};
@@ -0,0 +1,79 @@
+#include "SimilarityCache.h"
+#include "Utilities.h"
+
+#include <algorithm>
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+#define trav(x, v) for (auto &x : v)
+#define all(v) (v).begin(), (v).end()
+
+using namespace std;
+
+void SimilarityCache::update(SimilarityEngine &engine, const vector<wordID> &candidates,
+							 const vector<wordID> &words, int numThreads) {
+	if (candidates != candidateList) {
+		clear();
+		candidateList = candidates;
+	}
+
+	// Drop the words that are no longer used, and add columns for the new ones
+	unordered_map<wordID, vector<float>> kept;
+	vector<wordID> added;
+	vector<float *> addedColumns;
+	trav(word, words) {
+		if (kept.count(word)) {
+			continue;
+		}
+		auto it = columns.find(word);
+		if (it != columns.end()) {
+			kept[word] = move(it->second);
+		} else {
+			kept[word].resize(candidateList.size());
+			added.push_back(word);
+			addedColumns.push_back(kept[word].data());
+		}
+	}
+	columns = move(kept);
+
+	// One batch per block of candidates, so that every candidate row is read once for all new
+	// words. SimilarityEngine::similarityMatrix gives the same value for a pair of words whatever
+	// else is in the batch, so this does not change any results.
+	if (!added.empty()) {
+		int n = (int)added.size();
+		int numBlocks = ((int)candidateList.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		parallelFor(numBlocks, numThreads, [&](int block, int) {
+			static thread_local vector<float> similarities;
+			int start = block * BLOCK_SIZE;
+			int count = min((int)candidateList.size() - start, BLOCK_SIZE);
+			similarities.resize((size_t)n * count);
+			engine.similarityMatrix(added, &candidateList[start], count, similarities.data());
+			rep(i, 0, n) {
+				float *column = addedColumns[i] + start;
+				rep(j, 0, count) {
+					column[j] = similarities[(size_t)j * n + i];
+				}
+			}
+		});
+	}
+
+	order.clear();
+	trav(word, words) {
+		order.push_back(columns[word].data());
+	}
+}
+
+void SimilarityCache::gather(int start, int count, float *out) const {
+	int n = (int)order.size();
+	rep(i, 0, n) {
+		const float *column = order[i] + start;
+		rep(j, 0, count) {
+			out[(size_t)j * n + i] = column[j];
+		}
+	}
+}
+
+void SimilarityCache::clear() {
+	candidateList.clear();
+	columns.clear();
+	order.clear();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Dictionary.h"
+#include "SimilarityEngine.h"
+
+#include <unordered_map>
+#include <vector>
+
+/** Similarities between a list of candidate clues and the words a bot scores them against (the
+ * board words and earlier clues).
+ *
+ * Every word gets a column with its similarity to each candidate. A column is computed the first
+ * time the word is used and kept for as long as the word stays in use, so when a card is added,
+ * removed or changes type between two suggestions in the same game only the columns of new words
+ * have to be computed.
+ */
+struct SimilarityCache {
+	/** Makes sure there is a column for each of the words, in that order, and drops the columns
+	 * of all other words. All columns are dropped if the candidates changed. */
+	void update(SimilarityEngine &engine, const std::vector<wordID> &candidates,
+				const std::vector<wordID> &words, int numThreads);
+
+	/** Writes the similarities of candidates start to start+count-1 to the words passed to
+	 * #update, in the same layout as SimilarityEngine::similarityMatrix */
+	void gather(int start, int count, float *out) const;
+
+	void clear();
+
+   private:
+	// Number of candidates per SimilarityEngine::similarityMatrix call when filling a column
+	static const int BLOCK_SIZE = 256;
+
+	std::vector<wordID> candidateList;
+	std::unordered_map<wordID, std::vector<float>> columns;
+
+	// The columns of the words passed to the last #update, in order
+	std::vector<const float *> order;
+};
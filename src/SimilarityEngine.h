@@ -8,6 +8,19 @@ struct SimilarityEngine {
 	virtual bool load(const std::string &fileName, bool verbose) = 0;
 	virtual float similarity(wordID fixedWord, wordID dynWord) = 0;
 
+	/** Batched version of #similarity. Sets out[j * fixedWords.size() + i] to
+	 * similarity(fixedWords[i], dynWords[j]) for all 0 <= j < count, i.e. the scores of each
+	 * dynamic word against all the fixed words end up next to each other. */
+	virtual void similarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords,
+								  int count, float *out) = 0;
+
+	/** Like #similarityMatrix, but computed from full precision vectors even if the engine scans
+	 * quantized ones. Used to rerank a final shortlist of candidates. */
+	virtual void exactSimilarityMatrix(const std::vector<wordID> &fixedWords,
+									   const wordID *dynWords, int count, float *out) {
+		similarityMatrix(fixedWords, dynWords, count, out);
+	}
+
 	/** A commutative similarity measure, in contrast to the #similarity function which may change depending on the order of the parameters */
 	virtual float commutativeSimilarity(wordID word1, wordID word2) = 0;
 	virtual bool wordExists(const std::string &word) = 0;
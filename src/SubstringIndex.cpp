@@ -0,0 +1,130 @@
+#include "SubstringIndex.h"
+#include <algorithm>
+#include <cstring>
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+#define all(v) (v).begin(), (v).end()
+
+using namespace std;
+
+SubstringIndex::SubstringIndex(const Dictionary &dict, int count) {
+	count = min(count, dict.size());
+	starts.resize(count);
+	rep(i, 0, count) {
+		starts[i] = (int)text.size();
+		text += normalize(string(dict.getWord(wordID(i))));
+		text += '\0';
+	}
+
+	// Every suffix ends with the '\0' of its word, so strcmp compares suffixes within their words.
+	// Most suffixes are told apart by their first 8 characters, which are compared as one number.
+	struct Suffix {
+		uint64_t key;
+		int pos, word;
+	};
+	const char *data = text.data();
+	vector<Suffix> sorted;
+	sorted.reserve(text.size() - count);
+	rep(i, 0, count) {
+		for (int pos = starts[i]; data[pos] != '\0'; pos++) {
+			uint64_t key = 0;
+			int length = 0;
+			while (length < 8 && data[pos + length] != '\0') {
+				key = key << 8 | (uint8_t)data[pos + length];
+				length++;
+			}
+			key <<= 8 * (8 - length);
+			sorted.push_back(Suffix{key, pos, i});
+		}
+	}
+
+	// Radix sort by key, skipping the bytes that are the same for all suffixes, then sort the
+	// suffixes with equal keys by their remaining characters
+	vector<Suffix> buffer(sorted.size());
+	for (int shift = 0; shift < 64; shift += 8) {
+		vector<int> offsets(257, 0);
+		for (const Suffix &suffix : sorted) {
+			offsets[((suffix.key >> shift) & 0xff) + 1]++;
+		}
+		if (*max_element(all(offsets)) == (int)sorted.size()) {
+			continue;
+		}
+		rep(i, 0, 256) {
+			offsets[i + 1] += offsets[i];
+		}
+		for (const Suffix &suffix : sorted) {
+			buffer[offsets[(suffix.key >> shift) & 0xff]++] = suffix;
+		}
+		sorted.swap(buffer);
+	}
+	for (auto run = sorted.begin(); run != sorted.end();) {
+		auto runEnd = run + 1;
+		while (runEnd != sorted.end() && runEnd->key == run->key) {
+			++runEnd;
+		}
+		if ((run->key & 0xff) != 0 && runEnd - run > 1) {
+			sort(run, runEnd, [&](const Suffix &a, const Suffix &b) {
+				return strcmp(data + a.pos + 8, data + b.pos + 8) < 0;
+			});
+		}
+		run = runEnd;
+	}
+
+	// The suffixes that are whole words are in the order of the words. Empty words have no
+	// suffixes and come first.
+	suffixes.resize(sorted.size());
+	suffixWords.resize(sorted.size());
+	rep(i, 0, count) {
+		if (text[starts[i]] == '\0') {
+			sortedWords.push_back(i);
+		}
+	}
+	rep(i, 0, sorted.size()) {
+		suffixes[i] = sorted[i].pos;
+		suffixWords[i] = sorted[i].word;
+		if (sorted[i].pos == starts[sorted[i].word]) {
+			sortedWords.push_back(sorted[i].word);
+		}
+	}
+}
+
+void SubstringIndex::markConflicts(string_view word, vector<uint64_t> &bits) const {
+	string pattern = normalize(string(word));
+	auto mark = [&](int index) { bits[index >> 6] |= 1ULL << (index & 63); };
+	if (pattern.empty()) {
+		rep(i, 0, size()) {
+			mark(i);
+		}
+		return;
+	}
+
+	// Words that contain the pattern: the suffixes that start with it
+	const char *data = text.data();
+	size_t length = pattern.size();
+	auto first = lower_bound(all(suffixes), pattern, [&](int pos, const string &p) {
+		return strncmp(data + pos, p.c_str(), length) < 0;
+	});
+	auto last = upper_bound(first, suffixes.end(), pattern, [&](const string &p, int pos) {
+		return strncmp(p.c_str(), data + pos, length) < 0;
+	});
+	for (auto it = first; it != last; ++it) {
+		mark(suffixWords[it - suffixes.begin()]);
+	}
+
+	// Words contained in the pattern: empty words, and the substrings of the pattern that are
+	// words
+	for (int i = 0; i < size() && *wordAt(sortedWords[i]) == '\0'; i++) {
+		mark(sortedWords[i]);
+	}
+	rep(start, 0, length) {
+		rep(end, start + 1, length + 1) {
+			string_view part(pattern.data() + start, end - start);
+			auto found = lower_bound(all(sortedWords), part, [&](int index, string_view p) {
+				return string_view(wordAt(index)) < p;
+			});
+			for (; found != sortedWords.end() && string_view(wordAt(*found)) == part; ++found) {
+				mark(*found);
+			}
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Dictionary.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** Finds the words of a vocabulary that a given word is a substring or superstring of, as tested
+ * by #superOrSubstring, without comparing the word against every vocabulary word.
+ *
+ * Words that contain the given word are found in a suffix array over all vocabulary words, and
+ * words contained in it by looking up every substring of the given word in the sorted
+ * vocabulary.
+ */
+struct SubstringIndex {
+   private:
+	// The normalized words, each followed by a '\0', word i starting at starts[i]
+	std::string text;
+	std::vector<int> starts;
+
+	// The positions in text where a suffix of a word starts, sorted by the suffix up to the end
+	// of its word, and the word each of them belongs to
+	std::vector<int> suffixes;
+	std::vector<int> suffixWords;
+
+	// The word indices sorted by normalized word
+	std::vector<int> sortedWords;
+
+	inline const char *wordAt(int index) const {
+		return text.data() + starts[index];
+	}
+
+   public:
+	SubstringIndex() {}
+
+	/** Indexes the first count words of the dictionary, which are the candidates of a bot with a
+	 * vocabulary of that size */
+	SubstringIndex(const Dictionary &dict, int count);
+
+	/** The number of indexed words */
+	inline int size() const {
+		return (int)starts.size();
+	}
+
+	/** Sets bit i of bits for every indexed word i that contains word or is contained in it,
+	 * ignoring case. bits needs at least (#size + 63) / 64 elements. */
+	void markConflicts(std::string_view word, std::vector<uint64_t> &bits) const;
+};
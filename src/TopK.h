@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+/** Keeps the capacity largest of a stream of values, as ordered by Compare.
+ *
+ * The kept values are a heap with the smallest of them at the front, so a value that does not
+ * make the cut is rejected with a single comparison, and only values that do cost O(log
+ * capacity). Memory stays at capacity values however many are pushed. With a strict total order
+ * the kept values do not depend on the order in which they were pushed; otherwise values equal
+ * to the smallest kept one are not taken in once the selector is full.
+ */
+template <class T, class Compare = std::less<T>>
+struct TopK {
+   private:
+	// Orders the heap with the smallest value at the front
+	struct Inverted {
+		Compare compare;
+
+		bool operator()(const T &a, const T &b) const {
+			return compare(b, a);
+		}
+	};
+
+	std::vector<T> heap;
+	int capacity;
+	Inverted inverted;
+
+   public:
+	TopK(int capacity, Compare compare = Compare()) : capacity(capacity), inverted{compare} {
+		heap.reserve(std::max(capacity, 0));
+	}
+
+	inline int size() const {
+		return (int)heap.size();
+	}
+
+	inline bool full() const {
+		return (int)heap.size() >= capacity;
+	}
+
+	/** The smallest kept value. Only valid if #size is positive. */
+	inline const T &worst() const {
+		return heap.front();
+	}
+
+	/** True if #push would keep value */
+	inline bool accepts(const T &value) const {
+		if (!full()) {
+			return true;
+		}
+		return !heap.empty() && inverted.compare(heap.front(), value);
+	}
+
+	void push(const T &value) {
+		if (!accepts(value)) {
+			return;
+		}
+		if (full()) {
+			std::pop_heap(heap.begin(), heap.end(), inverted);
+			heap.back() = value;
+		} else {
+			heap.push_back(value);
+		}
+		std::push_heap(heap.begin(), heap.end(), inverted);
+	}
+
+	/** The kept values in no particular order */
+	inline const std::vector<T> &values() const {
+		return heap;
+	}
+
+	/** The kept values, largest first */
+	std::vector<T> sorted() const {
+		std::vector<T> res = heap;
+		std::sort(res.begin(), res.end(), inverted);
+		return res;
+	}
+
+	void clear() {
+		heap.clear();
+	}
+};
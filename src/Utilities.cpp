@@ -1,12 +1,12 @@
 #include "Utilities.h"
-#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
-float sigmoid(float x) {
-	return 1.0f / (1.0f + exp(-x));
-}
-
 void eraseFromVector(string word, vector<string> &v) {
 	for (int i = 0; i < (int)v.size(); i++) {
 		if (v[i] == word) {
@@ -15,3 +15,49 @@ void eraseFromVector(string word, vector<string> &v) {
 		}
 	}
 }
+
+int resolveThreadCount(int numThreads) {
+	if (numThreads > 0) {
+		return numThreads;
+	}
+	return max(1, (int)thread::hardware_concurrency());
+}
+
+void parallelFor(int count, int numThreads, const function<void(int, int)> &body) {
+	int threads = min(resolveThreadCount(numThreads), count);
+	if (threads <= 1) {
+		for (int i = 0; i < count; i++) {
+			body(i, 0);
+		}
+		return;
+	}
+
+	atomic<int> next(0);
+	exception_ptr error;
+	mutex errorMutex;
+	auto work = [&](int thread) {
+		try {
+			for (int i = next++; i < count; i = next++) {
+				body(i, thread);
+			}
+		} catch (...) {
+			lock_guard<mutex> lock(errorMutex);
+			if (!error) {
+				error = current_exception();
+			}
+			// Make the other threads stop early
+			next = count;
+		}
+	};
+	vector<std::thread> workers;
+	for (int t = 1; t < threads; t++) {
+		workers.emplace_back(work, t);
+	}
+	work(0);
+	for (auto &worker : workers) {
+		worker.join();
+	}
+	if (error) {
+		rethrow_exception(error);
+	}
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <new>
 #include <string>
 #include <vector>
 
@@ -8,6 +12,55 @@ typedef std::pair<int, int> pii;
 typedef std::vector<int> vi;
 typedef std::vector<pii> vpi;
 
-float sigmoid(float x);
+void eraseFromVector(std::string word, std::vector<std::string> &v);
 
-void eraseFromVector(std::string word, std::vector<std::string> &v);
\ No newline at end of file
+/** The number of threads to use when numThreads are requested, where 0 or less means one per
+ * hardware thread */
+int resolveThreadCount(int numThreads);
+
+/** Calls body(index, thread) for every index in [0, count), on up to numThreads threads (see
+ * #resolveThreadCount) of which the calling thread is number 0. Indices are handed out one at a
+ * time, so the order in which they are processed is unspecified. An exception thrown by body is
+ * rethrown in the calling thread once all threads have finished. */
+void parallelFor(int count, int numThreads, const std::function<void(int, int)> &body);
+
+/** Allocator handing out memory aligned to Alignment bytes (one cache line by default), so that
+ * SIMD loads from the start of a buffer never straddle a line boundary. */
+template <class T, size_t Alignment = 64>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	template <class U>
+	struct rebind {
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+
+	AlignedAllocator() {}
+
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+	T *allocate(size_t n) {
+		void *p = nullptr;
+		if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+			throw std::bad_alloc();
+		return (T *)p;
+	}
+
+	void deallocate(T *p, size_t) {
+		free(p);
+	}
+
+	template <class U>
+	bool operator==(const AlignedAllocator<U, Alignment> &) const {
+		return true;
+	}
+
+	template <class U>
+	bool operator!=(const AlignedAllocator<U, Alignment> &) const {
+		return false;
+	}
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -1,4 +1,5 @@
 #include "Word2GMSimilarityEngine.h"
+#include "Kernels.h"
 
 #include <algorithm>
 #include <cmath>
@@ -11,27 +12,35 @@
 
 using namespace std;
 
-float Word2GMSimilarityEngine::similarity(const WordEmbedding &v1, const WordEmbedding &v2) {
-	float sim = -1;
+float Word2GMSimilarityEngine::mixtureSimilarity(const float *distances) {
 	float sum = 0;
 	float cnt = 0;
-	for(auto& g1 : v1.gaussians) {
-		for(auto& g2 : v2.gaussians) {
-			float dis = 0;
-			rep(i,0,(int)g1.mus.size()){
-				float diff = g1.mus[i] - g2.mus[i];
-				dis += diff * diff;
-			}
-			cnt++;
-			sum += 1/((dis+0.1)*(dis+0.1)*(dis+0.1));
-			//sim = max(sim, (float)(-0.5 + 1.5 / (1.0 + 0.8 * dis * dis)));
-		}
+	rep(i, 0, COMPONENTS * COMPONENTS) {
+		float dis = distances[i];
+		cnt++;
+		sum += 1/((dis+0.1)*(dis+0.1)*(dis+0.1));
 	}
-	if(!cnt)
-		return 0;
 	float mean = cbrt(cnt/sum) - 0.1;
 	return -0.5 + 1.5 / (1.0 + 0.25 * mean * mean);
-	//return sim;
+}
+
+float Word2GMSimilarityEngine::similarity(int row1, int row2, bool exact) {
+	static_assert(COMPONENTS == 2, "The fused distance kernels compare two components per word");
+	if (row1 == -1 || row2 == -1)
+		return 0;
+	size_t rowSize = (size_t)COMPONENTS * muStride;
+	float distances[COMPONENTS * COMPONENTS];
+	if (vectorType == VectorType::FP32 || (exact && !mus.empty())) {
+		squaredDistances2x2(&mus[row1 * rowSize], &mus[row2 * rowSize], muStride, distances);
+	} else if (vectorType == VectorType::FP16) {
+		squaredDistances2x2Half(&halfMus[row1 * rowSize], &halfMus[row2 * rowSize], muStride,
+								distances);
+	} else {
+		squaredDistances2x2Byte(&byteMus[row1 * rowSize], &byteScales[row1 * COMPONENTS],
+								&byteMus[row2 * rowSize], &byteScales[row2 * COMPONENTS], muStride,
+								distances);
+	}
+	return mixtureSimilarity(distances);
 }
 
 /** Arbitrary statistic, in this case the word norm. */
@@ -39,6 +48,50 @@ float Word2GMSimilarityEngine::stat(wordID s) {
 	return 1;
 }
 
+void Word2GMSimilarityEngine::allocate(int numberOfWords, int dimension) {
+	const int align = ModelHeader::ROW_ALIGNMENT;
+	muDim = dimension / COMPONENTS - 1;
+	muStride = (muDim + align - 1) / align * align;
+	size_t values = (size_t)numberOfWords * COMPONENTS * muStride;
+	bool keepMus = vectorType == VectorType::FP32 || keepExactVectors;
+	mus = AlignedVector<float>(keepMus ? values : 0, 0.0f);
+	halfMus = AlignedVector<uint16_t>(vectorType == VectorType::FP16 ? values : 0);
+	byteMus = AlignedVector<int8_t>(vectorType == VectorType::INT8 ? values : 0);
+	byteScales.assign(vectorType == VectorType::INT8 ? numberOfWords * COMPONENTS : 0, 1.0f);
+	logsigs.assign(numberOfWords * COMPONENTS, 0.0f);
+	rowBuffer.assign(COMPONENTS * muStride, 0.0f);
+	id2row.assign(dict.size(), -1);
+	index2id.resize(numberOfWords);
+}
+
+void Word2GMSimilarityEngine::setEmbedding(int r, wordID id, const float *values, int dimension,
+										   float norm) {
+	if ((int)id >= (int)id2row.size()) {
+		id2row.resize(id + 1, -1);
+	}
+	id2row[id] = r;
+	index2id[r] = id;
+
+	float scale = sqrt(norm);
+	size_t offset = (size_t)r * COMPONENTS * muStride;
+	float *out = mus.empty() ? rowBuffer.data() : &mus[offset];
+	rep(c, 0, COMPONENTS) {
+		const float *component = values + c * (dimension / COMPONENTS);
+		logsigs[r * COMPONENTS + c] = component[0] * scale;
+		rep(i, 0, muDim) {
+			out[c * muStride + i] = component[1 + i] * scale;
+		}
+	}
+	if (vectorType == VectorType::FP16) {
+		quantizeHalf(out, &halfMus[offset], COMPONENTS * muStride);
+	} else if (vectorType == VectorType::INT8) {
+		rep(c, 0, COMPONENTS) {
+			byteScales[r * COMPONENTS + c] =
+				quantizeByte(out + c * muStride, &byteMus[offset + c * muStride], muStride);
+		}
+	}
+}
+
 /** Returns true if successful */
 bool Word2GMSimilarityEngine::load(const string &fileName, bool verbose) {
 	int dimension, numberOfWords;
@@ -55,6 +108,10 @@ bool Word2GMSimilarityEngine::load(const string &fileName, bool verbose) {
 		cerr << "Failed to load " << fileName << endl;
 		return false;
 	}
+	if (formatVersion >= ModelHeader::VERSION) {
+		fin.close();
+		return loadMapped(fileName, verbose);
+	}
 	if (verbose) {
 		cerr << "Loading word2vec (" << numberOfWords << " words, " << dimension
 			 << " dimensions, model " << modelid << '.' << formatVersion << ")... " << flush;
@@ -65,11 +122,7 @@ bool Word2GMSimilarityEngine::load(const string &fileName, bool verbose) {
 	char buf[bufSize];
 	string word;
 	vector<float> values(dimension);
-	vector<float> valuesd;
-	// Note: Very conservative size, this may waste quite a lot of space if the words are already in
-	// the dictionary
-	words.resize(numberOfWords + dict.size());
-	index2id.resize(numberOfWords);
+	allocate(numberOfWords, dimension);
 	rep(i, 0, numberOfWords) {
 		int len;
 		fin.read((char *)&len, sizeof len);
@@ -93,21 +146,50 @@ bool Word2GMSimilarityEngine::load(const string &fileName, bool verbose) {
 			return false;
 		}
 		word.assign(buf, buf + len);
-		valuesd.assign(all(values));
-		for(int i = 0; i < dimension; i++){
-			valuesd[i] *= sqrt(norm);
-		}
-		wordID id = dict.addWord(word);
-		words[id].gaussians.resize(2);
-		words[id].gaussians[0].logsig = valuesd[0];
-		words[id].gaussians[1].logsig = valuesd[dimension/2];
-		words[id].gaussians[0].mus.resize(dimension/2-1);
-		words[id].gaussians[1].mus.resize(dimension/2-1);
-		for(int i = 0; i < dimension/2-1; i++){
-			words[id].gaussians[0].mus[i] = valuesd[1+i];
-			words[id].gaussians[1].mus[i] = valuesd[1+dimension/2+i];
+		setEmbedding(i, dict.addWord(word), values.data(), dimension, norm);
+	}
+	if (verbose) {
+		cerr << "done!" << endl;
+	}
+	return true;
+}
+
+bool Word2GMSimilarityEngine::loadMapped(const string &fileName, bool verbose) {
+	ModelFile file;
+	if (!file.open(fileName)) {
+		return false;
+	}
+	const ModelHeader &header = file.header();
+	formatVersion = header.formatVersion;
+	modelid = header.modelid;
+	int numberOfWords = header.numberOfWords, dimension = header.dimension;
+	if (verbose) {
+		cerr << "Loading word2vec (" << numberOfWords << " words, " << dimension
+			 << " dimensions, model " << modelid << '.' << formatVersion << ")... " << flush;
+	}
+
+	// Quantized files stay quantized, unless a different type was asked for
+	if (vectorType == VectorType::FP32) {
+		vectorType = header.vectorType;
+	}
+	const char *vectors = (const char *)file.vectorData();
+	size_t rowBytes = (size_t)header.stride * vectorTypeSize(header.vectorType);
+	const float *norms = file.norms();
+	vector<float> values(header.stride);
+	// An empty dictionary takes over the hash table of the file instead of hashing every word
+	bool prebuilt = file.loadDictionary(dict);
+	allocate(numberOfWords, dimension);
+	rep(i, 0, numberOfWords) {
+		const char *row = vectors + i * rowBytes;
+		if (header.vectorType == VectorType::FP16) {
+			dequantizeHalf((const uint16_t *)row, values.data(), header.stride);
+		} else if (header.vectorType == VectorType::INT8) {
+			dequantizeByte((const int8_t *)row, file.scales()[i], values.data(), header.stride);
+		} else {
+			copy((const float *)row, (const float *)row + header.stride, values.begin());
 		}
-		index2id[i] = id;
+		wordID id = prebuilt ? (wordID)i : dict.addWord(file.word(i));
+		setEmbedding(i, id, values.data(), dimension, norms[i]);
 	}
 	if (verbose) {
 		cerr << "done!" << endl;
@@ -116,14 +198,39 @@ bool Word2GMSimilarityEngine::load(const string &fileName, bool verbose) {
 }
 
 bool Word2GMSimilarityEngine::wordExists(const string &word) {
-	return dict.wordExists(word) && words[dict.getID(word)].gaussians.size() > 0;
+	return dict.wordExists(word) && row(dict.getID(word)) != -1;
 }
 
 float Word2GMSimilarityEngine::commutativeSimilarity(wordID fixedWord, wordID dynWord) {
-	return similarity(words.at(fixedWord), words.at(dynWord));
+	return similarity(row(fixedWord), row(dynWord));
 }
 
 float Word2GMSimilarityEngine::similarity(wordID fixedWord, wordID dynWord) {
-	float sim = similarity(words.at(fixedWord), words.at(dynWord));
-	return sim;
+	return similarity(row(fixedWord), row(dynWord));
+}
+
+void Word2GMSimilarityEngine::similarityMatrix(const vector<wordID> &fixedWords,
+											   const wordID *dynWords, int count, float *out) {
+	similarityMatrix(fixedWords, dynWords, count, out, false);
+}
+
+void Word2GMSimilarityEngine::exactSimilarityMatrix(const vector<wordID> &fixedWords,
+													const wordID *dynWords, int count, float *out) {
+	similarityMatrix(fixedWords, dynWords, count, out, true);
+}
+
+void Word2GMSimilarityEngine::similarityMatrix(const vector<wordID> &fixedWords,
+											   const wordID *dynWords, int count, float *out,
+											   bool exact) {
+	int n = (int)fixedWords.size();
+	vector<int> fixedRows(n);
+	rep(i, 0, n) {
+		fixedRows[i] = row(fixedWords[i]);
+	}
+	rep(j, 0, count) {
+		int dynRow = row(dynWords[j]);
+		rep(i, 0, n) {
+			out[(size_t)j * n + i] = similarity(fixedRows[i], dynRow, exact);
+		}
+	}
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Dictionary.h"
+#include "ModelFile.h"
 #include "SimilarityEngine.h"
 
 #include <map>
@@ -9,25 +10,68 @@
 
 #include "Utilities.h"
 
-struct Gaussian {
-	std::vector<float> mus;
-	float logsig;
-};
-
-struct WordEmbedding{
-	std::vector<Gaussian> gaussians;
-};
-
 struct Word2GMSimilarityEngine final : SimilarityEngine {
    private:
+	// Every word is a mixture of this many gaussians
+	static const int COMPONENTS = 2;
+
 	int formatVersion, modelid;
-	std::vector<WordEmbedding> words;
+	int muDim = 0, muStride = 0;
+
+	// The means of all components of all words, as one row of COMPONENTS * muStride floats per
+	// word in the order of the model file. Each mean is padded with zeros to a multiple of
+	// ModelHeader::ROW_ALIGNMENT floats. Empty if the model is only kept in quantized form.
+	AlignedVector<float> mus;
+
+	// Quantized versions of mus with the same layout, used instead of it depending on
+	// vectorType. The bytes of each mean are multiplied by the matching entry of byteScales.
+	AlignedVector<uint16_t> halfMus;
+	AlignedVector<int8_t> byteMus;
+	std::vector<float> byteScales;
+
+	// log(sigma) of every component, parallel to the means
+	std::vector<float> logsigs;
+
+	// Row of each word ID, or -1 for words that are not in this model
+	std::vector<int> id2row;
 	std::vector<wordID> index2id;
+
+	// Scratch row for setEmbedding when mus is not kept
+	AlignedVector<float> rowBuffer;
 	Dictionary &dict;
-	float similarity(const WordEmbedding &v1, const WordEmbedding &v2);
+
+	inline int row(wordID s) const {
+		return (int)s < (int)id2row.size() ? id2row[(int)s] : -1;
+	}
+
+	/** Similarity between the mixtures in two rows. Uses the quantized means unless exact is set
+	 * and the full precision ones are available. */
+	float similarity(int row1, int row2, bool exact = false);
+
+	/** Combines the squared distances between all pairs of components of two words */
+	static float mixtureSimilarity(const float *distances);
+
+	void similarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords, int count,
+						  float *out, bool exact);
+
+	/** Sizes the arrays for a model with the given number of words and vector dimension */
+	void allocate(int numberOfWords, int dimension);
+
+	/** Splits a (normalized) model vector into the gaussians of the word in the given row */
+	void setEmbedding(int r, wordID id, const float *values, int dimension, float norm);
+
+	/** Loads a version 2 model file by mapping it into memory */
+	bool loadMapped(const std::string &fileName, bool verbose);
 	enum Models { GLOVE = 1, CONCEPTNET = 2, WORD2GM = 3 };
 
    public:
+	// Element type of the means that are compared, set before calling #load. Version 2 model
+	// files that are stored quantized keep their type unless another quantized type is set.
+	VectorType vectorType = VectorType::FP32;
+
+	// Keep the full precision means next to the quantized ones, so that #exactSimilarityMatrix
+	// can use them
+	bool keepExactVectors = false;
 
 	Word2GMSimilarityEngine(Dictionary &dict) : dict(dict) {}
 
@@ -39,6 +83,10 @@ struct Word2GMSimilarityEngine final : SimilarityEngine {
 
 	float commutativeSimilarity(wordID word1, wordID word2);
 	float similarity(wordID fixedWord, wordID dynWord);
+	void similarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords, int count,
+						  float *out);
+	void exactSimilarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords,
+							   int count, float *out);
 
 	/** True if the word2vec model includes a vector for the specified word */
 	bool wordExists(const std::string &word);
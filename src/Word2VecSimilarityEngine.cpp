@@ -1,4 +1,6 @@
 #include "Word2VecSimilarityEngine.h"
+#include "Kernels.h"
+#include "TopK.h"
 
 #include <algorithm>
 #include <cmath>
@@ -10,22 +12,102 @@
 
 using namespace std;
 
-float Word2VecSimilarityEngine::similarity(const vector<float> &v1, const vector<float> &v2) {
-	float sim = 0;
-	int dim = (int)v1.size();
-	rep(i, 0, dim) {
-		sim += v1[i] * v2[i];
+float Word2VecSimilarityEngine::similarity(const float *v1, const float *v2) {
+	return dotProduct(v1, v2, stride);
+}
+
+float Word2VecSimilarityEngine::rowSimilarity(const float *query, int r, bool exact) {
+	if (vectorType == VectorType::FP32 || (exact && matrix != nullptr)) {
+		return similarity(query, rowVector(r));
+	} else if (vectorType == VectorType::FP16) {
+		return dotProductHalf(query, halfMatrix + (size_t)r * stride, stride);
+	} else {
+		return dotProductByte(query, byteMatrix + (size_t)r * stride, stride) * rowScales[r];
+	}
+}
+
+void Word2VecSimilarityEngine::decodeRow(int r, float *out, bool exact) {
+	if (vectorType == VectorType::FP32 || (exact && matrix != nullptr)) {
+		copy(rowVector(r), rowVector(r) + stride, out);
+	} else if (vectorType == VectorType::FP16) {
+		dequantizeHalf(halfMatrix + (size_t)r * stride, out, stride);
+	} else {
+		dequantizeByte(byteMatrix + (size_t)r * stride, rowScales[r], out, stride);
+	}
+}
+
+const float *Word2VecSimilarityEngine::fixedRow(int r) {
+	if (vectorType == VectorType::FP32) {
+		return rowVector(r);
+	}
+	static thread_local AlignedVector<float> buffer;
+	buffer.resize(stride);
+	decodeRow(r, buffer.data(), false);
+	return buffer.data();
+}
+
+void Word2VecSimilarityEngine::quantize() {
+	size_t rows = index2id.size();
+	halfStorage.clear();
+	byteStorage.clear();
+	scaleStorage.clear();
+	if (vectorType == VectorType::FP16) {
+		halfStorage.resize(rows * stride);
+		quantizeHalf(matrix, halfStorage.data(), (int)(rows * stride));
+		halfMatrix = halfStorage.data();
+	} else if (vectorType == VectorType::INT8) {
+		byteStorage.resize(rows * stride);
+		scaleStorage.resize(rows);
+		rep(r, 0, rows) {
+			int8_t *out = byteStorage.data() + (size_t)r * stride;
+			scaleStorage[r] = quantizeByte(rowVector(r), out, stride);
+		}
+		byteMatrix = byteStorage.data();
+		rowScales = scaleStorage.data();
 	}
-	return sim;
+}
+
+void Word2VecSimilarityEngine::materializeVectors() {
+	if (matrix != nullptr) {
+		return;
+	}
+	storage.resize(index2id.size() * stride);
+	rep(r, 0, index2id.size()) {
+		decodeRow(r, storage.data() + (size_t)r * stride, false);
+	}
+	matrix = storage.data();
 }
 
 /** Arbitrary statistic, in this case the word norm. */
 float Word2VecSimilarityEngine::stat(wordID s) {
-	return wordNorms[s];
+	return getNorm(s);
 }
 
-const vector<float>& Word2VecSimilarityEngine::getVector(wordID s) {
-	return words[s];
+const float *Word2VecSimilarityEngine::getVector(wordID s) {
+	int r = row(s);
+	if (r == -1) {
+		return nullptr;
+	}
+	materializeVectors();
+	return rowVector(r);
+}
+
+float *Word2VecSimilarityEngine::getMutableVector(wordID s) {
+	materializeVectors();
+	if (mappedFile) {
+		if (storage.empty()) {
+			storage.assign(matrix, matrix + (size_t)index2id.size() * stride);
+			matrix = storage.data();
+		}
+		mappedFile.reset();
+	}
+	vectorType = VectorType::FP32;
+	halfMatrix = nullptr;
+	byteMatrix = nullptr;
+	rowScales = nullptr;
+	// The graph no longer matches the vectors once they change
+	index.clear();
+	return const_cast<float *>(getVector(s));
 }
 
 /** Returns true if successful */
@@ -44,6 +126,14 @@ bool Word2VecSimilarityEngine::load(const string &fileName, bool verbose) {
 		cerr << "Failed to load " << fileName << endl;
 		return false;
 	}
+	if (formatVersion >= ModelHeader::VERSION) {
+		fin.close();
+		if (!loadMapped(fileName, verbose)) {
+			return false;
+		}
+		loadIndex(indexFileName(fileName), verbose);
+		return true;
+	}
 	if (verbose) {
 		cerr << "Loading word2vec (" << numberOfWords << " words, " << dimension
 			 << " dimensions, model " << modelid << '.' << formatVersion << ")... " << flush;
@@ -53,13 +143,14 @@ bool Word2VecSimilarityEngine::load(const string &fileName, bool verbose) {
 	float norm;
 	char buf[bufSize];
 	string word;
-	vector<float> values(dimension);
-	vector<float> valuesd;
-	// Note: Very conservative size, this may waste quite a lot of space if the words are already in
-	// the dictionary
-	words.resize(numberOfWords + dict.size());
-	wordNorms.resize(numberOfWords + dict.size());
+	dim = dimension;
+	stride = (dimension + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+	mappedFile.reset();
+	storage.assign((size_t)numberOfWords * stride, 0.0f);
+	matrix = storage.data();
+	wordNorms.resize(numberOfWords);
 	index2id.resize(numberOfWords);
+	id2row.assign(dict.size(), -1);
 	rep(i, 0, numberOfWords) {
 		int len;
 		fin.read((char *)&len, sizeof len);
@@ -77,39 +168,151 @@ bool Word2VecSimilarityEngine::load(const string &fileName, bool verbose) {
 		} else {
 			norm = 1.0f;
 		}
-		fin.read((char *)values.data(), dimension * sizeof(float));
+		fin.read((char *)(storage.data() + (size_t)i * stride), dimension * sizeof(float));
 		if (!fin) {
 			cerr << "failed at reading entry " << i << endl;
 			return false;
 		}
 		word.assign(buf, buf + len);
-		valuesd.assign(all(values));
 		wordID id = dict.addWord(word);
-		words[id] = move(valuesd);
-		wordNorms[id] = norm;
+		if ((int)id >= (int)id2row.size()) {
+			id2row.resize(id + 1, -1);
+		}
+		id2row[id] = i;
+		wordNorms[i] = norm;
 		index2id[i] = id;
 		if (modelid == Models::GLOVE) {
-			wordNorms[id] = min(pow(wordNorms[id], 0.4f), 5.3f);
+			wordNorms[i] = min(pow(wordNorms[i], 0.4f), 5.3f);
+		}
+	}
+	if (vectorType != VectorType::FP32) {
+		quantize();
+		if (!keepExactVectors) {
+			storage = AlignedVector<float>();
+			matrix = nullptr;
 		}
 	}
 	if (verbose) {
 		cerr << "done!" << endl;
 	}
+	loadIndex(indexFileName(fileName), verbose);
+	return true;
+}
+
+void Word2VecSimilarityEngine::loadIndex(const string &fileName, bool verbose) {
+	index.clear();
+	if (!ifstream(fileName)) {
+		return;
+	}
+	if (!index.load(fileName) || index.size() != (int)index2id.size() ||
+		index.fingerprint != fingerprint()) {
+		cerr << "Ignoring " << fileName << ", which does not match the model" << endl;
+		index.clear();
+	} else if (verbose) {
+		cerr << "Loaded nearest neighbour index " << fileName << endl;
+	}
+}
+
+uint64_t Word2VecSimilarityEngine::fingerprint() const {
+	// 64-bit FNV-1a
+	uint64_t h = 0xcbf29ce484222325ULL;
+	auto add = [&](const void *data, size_t size) {
+		rep(i, 0, size) {
+			h = (h ^ ((const unsigned char *)data)[i]) * 0x100000001b3ULL;
+		}
+	};
+	int shape[3] = {(int)index2id.size(), dim, modelid};
+	add(shape, sizeof shape);
+	rep(r, 0, index2id.size()) {
+		string_view word = dict.getWord(index2id[r]);
+		add(word.data(), word.size());
+		add("", 1);
+	}
+	add(wordNorms.data(), wordNorms.size() * sizeof(float));
+	return h;
+}
+
+void Word2VecSimilarityEngine::buildIndex(const HnswIndex::Params &params) {
+	index.build((int)index2id.size(),
+				[&](int r1, int r2) { return rowSimilarity(fixedRow(r1), r2, false); }, params);
+	index.fingerprint = fingerprint();
+}
+
+bool Word2VecSimilarityEngine::saveIndex(const string &fileName) const {
+	return index.save(fileName);
+}
+
+bool Word2VecSimilarityEngine::loadMapped(const string &fileName, bool verbose) {
+	unique_ptr<ModelFile> file(new ModelFile());
+	if (!file->open(fileName)) {
+		return false;
+	}
+	const ModelHeader &header = file->header();
+	formatVersion = header.formatVersion;
+	modelid = header.modelid;
+	int numberOfWords = header.numberOfWords;
+	if (verbose) {
+		cerr << "Loading word2vec (" << numberOfWords << " words, " << header.dimension
+			 << " dimensions, model " << modelid << '.' << formatVersion << ")... " << flush;
+	}
+
+	// The vectors are used in place, only the per-word metadata is copied
+	dim = header.dimension;
+	stride = header.stride;
+	storage.clear();
+	matrix = nullptr;
+	if (header.vectorType == VectorType::FP32) {
+		matrix = file->vectors();
+	} else {
+		vectorType = header.vectorType;
+		if (vectorType == VectorType::FP16) {
+			halfMatrix = (const uint16_t *)file->vectorData();
+		} else {
+			byteMatrix = (const int8_t *)file->vectorData();
+			rowScales = file->scales();
+		}
+	}
+	const float *norms = file->norms();
+	wordNorms.assign(norms, norms + numberOfWords);
+	index2id.resize(numberOfWords);
+	// An empty dictionary takes over the hash table of the file instead of hashing every word
+	bool prebuilt = file->loadDictionary(dict);
+	id2row.assign(dict.size(), -1);
+	rep(i, 0, numberOfWords) {
+		wordID id = prebuilt ? (wordID)i : dict.addWord(file->word(i));
+		if ((int)id >= (int)id2row.size()) {
+			id2row.resize(id + 1, -1);
+		}
+		id2row[id] = i;
+		index2id[i] = id;
+		if (modelid == Models::GLOVE) {
+			wordNorms[i] = min(pow(wordNorms[i], 0.4f), 5.3f);
+		}
+	}
+	mappedFile = move(file);
+	if (header.vectorType == VectorType::FP32 && vectorType != VectorType::FP32) {
+		quantize();
+	}
+	if (verbose) {
+		cerr << "done!" << endl;
+	}
 	return true;
 }
 
 bool Word2VecSimilarityEngine::wordExists(const string &word) {
-	return dict.wordExists(word) && words[dict.getID(word)].size() > 0;
+	return dict.wordExists(word) && row(dict.getID(word)) != -1;
 }
 
 float Word2VecSimilarityEngine::commutativeSimilarity(wordID fixedWord, wordID dynWord) {
-	return similarity(words.at(fixedWord), words.at(dynWord));
+	int r1 = row(fixedWord), r2 = row(dynWord);
+	if (r1 == -1 || r2 == -1)
+		return 0;
+	return rowSimilarity(fixedRow(r1), r2, false);
 }
 
-float Word2VecSimilarityEngine::similarity(wordID fixedWord, wordID dynWord) {
-	float sim = similarity(words.at(fixedWord), words.at(dynWord));
+float Word2VecSimilarityEngine::adjustSimilarity(float sim, int dynRow) {
 	if (modelid == Models::GLOVE) {
-		return sim * wordNorms[dynWord] / 4.5f;
+		return sim * wordNorms[dynRow] / 4.5f;
 	} else if (modelid == Models::CONCEPTNET) {
 		return (sim <= 0 ? sim : pow(sim, 0.66f) * 1.6f);
 	} else {
@@ -117,23 +320,97 @@ float Word2VecSimilarityEngine::similarity(wordID fixedWord, wordID dynWord) {
 	}
 }
 
+float Word2VecSimilarityEngine::similarity(wordID fixedWord, wordID dynWord) {
+	int r1 = row(fixedWord), r2 = row(dynWord);
+	if (r1 == -1 || r2 == -1)
+		return 0;
+	return adjustSimilarity(rowSimilarity(fixedRow(r1), r2, false), r2);
+}
+
+void Word2VecSimilarityEngine::similarityMatrix(const vector<wordID> &fixedWords,
+												const wordID *dynWords, int count, float *out) {
+	similarityMatrix(fixedWords, dynWords, count, out, false);
+}
+
+void Word2VecSimilarityEngine::exactSimilarityMatrix(const vector<wordID> &fixedWords,
+													 const wordID *dynWords, int count,
+													 float *out) {
+	similarityMatrix(fixedWords, dynWords, count, out, true);
+}
+
+void Word2VecSimilarityEngine::similarityMatrix(const vector<wordID> &fixedWords,
+												const wordID *dynWords, int count, float *out,
+												bool exact) {
+	// Copy the fixed vectors into one small block that stays in L1 while the dynamic rows are
+	// streamed past it
+	int n = (int)fixedWords.size();
+	AlignedVector<float> fixed((size_t)n * stride, 0.0f);
+	vector<bool> hasVector(n);
+	rep(i, 0, n) {
+		int r = row(fixedWords[i]);
+		hasVector[i] = r != -1;
+		if (r != -1) {
+			decodeRow(r, fixed.data() + (size_t)i * stride, exact);
+		}
+	}
+
+	rep(j, 0, count) {
+		float *res = out + (size_t)j * n;
+		int r2 = row(dynWords[j]);
+		if (r2 == -1) {
+			fill(res, res + n, 0.0f);
+			continue;
+		}
+		rep(i, 0, n) {
+			if (hasVector[i]) {
+				float sim = rowSimilarity(fixed.data() + (size_t)i * stride, r2, exact);
+				res[i] = adjustSimilarity(sim, r2);
+			} else {
+				res[i] = 0;
+			}
+		}
+	}
+}
+
 vector<pair<float, string>> Word2VecSimilarityEngine::similarWords(const string &s) {
 	if (!wordExists(s)) {
 		cout << denormalize(s) << " does not occur in the corpus" << endl;
 		return vector<pair<float, string>>();
 	}
-	return similarWords(getVector(dict.getID(s)));
+	const float *vec = fixedRow(row(dict.getID(s)));
+	return similarWords(vector<float>(vec, vec + dim));
 }
 
-vector<pair<float, string>> Word2VecSimilarityEngine::similarWords(const vector<float> &s) {
+vector<pair<float, wordID>> Word2VecSimilarityEngine::nearestNeighbors(const vector<float> &query,
+																		 int k) {
+	// Pad the query like a matrix row so that it can be compared against whole rows
+	AlignedVector<float> padded(stride);
+	copy(query.begin(), query.begin() + min((int)query.size(), dim), padded.begin());
 	vector<pair<float, wordID>> ret;
-	for (auto id : index2id) {
-		ret.push_back(make_pair(-similarity(s, getVector(id)), id));
+	if (!index.empty()) {
+		auto found = index.search([&](int r) { return rowSimilarity(padded.data(), r, false); }, k,
+								  searchEf);
+		for (auto &pa : found) {
+			ret.push_back(make_pair(pa.first, index2id[pa.second]));
+		}
+		return ret;
+	}
+	// Most similar first, equal similarities by the smaller ID
+	auto compare = [](const pair<float, wordID> &a, const pair<float, wordID> &b) {
+		return a.first < b.first || (a.first == b.first && a.second > b.second);
+	};
+	TopK<pair<float, wordID>, decltype(compare)> best(k, compare);
+	rep(r, 0, index2id.size()) {
+		pair<float, wordID> entry(rowSimilarity(padded.data(), r, false), index2id[r]);
+		best.push(entry);
 	}
-	sort(all(ret));
+	return best.sorted();
+}
+
+vector<pair<float, string>> Word2VecSimilarityEngine::similarWords(const vector<float> &s) {
 	vector<pair<float, string>> res;
-	rep(i, 0, 10) {
-		res.push_back(make_pair(-ret[i].first, dict.getWord(ret[i].second)));
+	for (auto &pa : nearestNeighbors(s, 10)) {
+		res.push_back(make_pair(pa.first, string(dict.getWord(pa.second))));
 	}
 	return res;
 }
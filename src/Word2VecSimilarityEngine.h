@@ -1,9 +1,12 @@
 #pragma once
 
 #include "Dictionary.h"
+#include "HnswIndex.h"
+#include "ModelFile.h"
 #include "SimilarityEngine.h"
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,25 +15,113 @@
 struct Word2VecSimilarityEngine final : SimilarityEngine {
    private:
 	int formatVersion, modelid;
-	std::vector<std::vector<float>> words;
+	int dim = 0, stride = 0;
+
+	// All word vectors as a single row-major matrix, one row per word in the order of the model
+	// file. Rows are padded with zeros to a multiple of ROW_ALIGNMENT floats so that every row
+	// starts on a cache line and can be processed in whole SIMD registers.
+	// The matrix either lives in storage, or in mappedFile for version 2 model files.
+	// matrix is nullptr if the model is only available in quantized form.
+	const float *matrix = nullptr;
+	AlignedVector<float> storage;
+	std::unique_ptr<ModelFile> mappedFile;
+
+	// Quantized version of the matrix with the same stride, which is scanned instead of it when
+	// vectorType is not FP32. Points either into the storage below or into mappedFile.
+	const uint16_t *halfMatrix = nullptr;
+	const int8_t *byteMatrix = nullptr;
+	const float *rowScales = nullptr;
+	AlignedVector<uint16_t> halfStorage;
+	AlignedVector<int8_t> byteStorage;
+	std::vector<float> scaleStorage;
+
+	// Matrix row of each word ID, or -1 for words that have no vector in this model
+	std::vector<int> id2row;
+
+	// Word ID of each matrix row
 	std::vector<wordID> index2id;
+
+	// Nearest neighbour graph over the matrix rows, empty unless built or loaded
+	HnswIndex index;
 	Dictionary &dict;
 	enum Models { GLOVE = 1, CONCEPTNET = 2 };
 
-	// All word vectors are stored normalized -- wordNorms holds their original squared norms.
-	// In some embeddings, words that have more (specific) meanings have higher norms.
+	// All word vectors are stored normalized -- wordNorms holds their original squared norms,
+	// indexed by matrix row. In some embeddings, words that have more (specific) meanings have
+	// higher norms.
 	std::vector<float> wordNorms;
 
-	/** Similarity between two word vectors.
+	/** Similarity between two word vectors of length #stride.
 	 * Implemented as an inner product. This is the main bottleneck of the
-	 * engine, and it gains a lot from being compiled with "-O3 -mavx".
+	 * engine, so it uses the SIMD kernel that best fits the CPU.
 	 */
-	float similarity(const std::vector<float> &v1, const std::vector<float> &v2);
+	float similarity(const float *v1, const float *v2);
+
+	/** Inner product of a padded query vector and a matrix row. Uses the quantized rows unless
+	 * exact is set and full precision vectors are available. */
+	float rowSimilarity(const float *query, int r, bool exact);
+
+	/** Writes the padded vector of a matrix row to out, decoding it if it is quantized */
+	void decodeRow(int r, float *out, bool exact);
+
+	/** The padded vector of a matrix row, decoded into a thread local buffer if necessary */
+	const float *fixedRow(int r);
+
+	/** Builds the quantized version of the matrix according to vectorType */
+	void quantize();
+
+	/** Makes sure that matrix is available, by decoding the quantized rows if necessary */
+	void materializeVectors();
+
+	void similarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords, int count,
+						  float *out, bool exact);
+
+	/** Applies the model specific adjustment of a raw inner product with the vector of the
+	 * dynamic word, stored in the given matrix row */
+	float adjustSimilarity(float sim, int dynRow);
+
+	inline int row(wordID s) const {
+		return (int)s < (int)id2row.size() ? id2row[(int)s] : -1;
+	}
+
+	inline const float *rowVector(int r) const {
+		return matrix + (size_t)r * stride;
+	}
+
+	/** Loads a version 2 model file by mapping it into memory */
+	bool loadMapped(const std::string &fileName, bool verbose);
+
+	/** Loads the index stored next to the model, if there is one that matches it */
+	void loadIndex(const std::string &fileName, bool verbose);
+
+	/** Hash of the shape, model ID, words and norms of the model, which tells the indexes of
+	 * different models apart */
+	uint64_t fingerprint() const;
 
    public:
+	/** Number of floats each matrix row is padded to a multiple of (64 bytes) */
+	static const int ROW_ALIGNMENT = ModelHeader::ROW_ALIGNMENT;
+
+	// Element type of the vectors that are scanned, set before calling #load. FP16 and INT8
+	// use 2-4 times less memory and bandwidth for a small loss of precision. Version 2 model files
+	// that are stored quantized override this.
+	VectorType vectorType = VectorType::FP32;
+
+	// Keep the full precision vectors next to the quantized ones, so that #exactSimilarityMatrix
+	// can use them. Memory-mapped models always keep them, since they cost nothing until used.
+	bool keepExactVectors = false;
+
+	// Size of the candidate list when searching the nearest neighbour index. Higher values give
+	// better recall at the cost of speed.
+	int searchEf = 64;
+
+	/** File name of the nearest neighbour index of a model. #load picks it up automatically. */
+	static std::string indexFileName(const std::string &modelFile) {
+		return modelFile + ".hnsw";
+	}
+
 	inline int dimension() {
-		// TODO: Use field instead?
-		return words[0].size();
+		return dim;
 	}
 
 	Word2VecSimilarityEngine(Dictionary &dict) : dict(dict) {}
@@ -38,17 +129,40 @@ struct Word2VecSimilarityEngine final : SimilarityEngine {
 	/** Arbitrary statistic, in this case the word norm. */
 	float stat(wordID s);
 
-	const std::vector<float>& getVector(wordID s);
+	/** Vector of #dimension() floats for the word, or nullptr if the word has no vector.
+	 * For quantized models, all vectors are decoded on the first call. */
+	const float *getVector(wordID s);
+
+	/** Like #getVector, but the vector may be modified. If the model is memory-mapped or
+	 * quantized, all vectors are first copied out of the file and the engine goes back to
+	 * scanning full precision vectors. */
+	float *getMutableVector(wordID s);
 
 	inline float getNorm(wordID s) {
-		return wordNorms[(int)s];
+		int r = row(s);
+		return r == -1 ? 0 : wordNorms[r];
 	}
 
 	/** Returns true if successful */
 	bool load(const std::string &fileName, bool verbose);
 
+	/** Builds a nearest neighbour index over all words, replacing any loaded one */
+	void buildIndex(const HnswIndex::Params &params);
+
+	/** Returns true if successful */
+	bool saveIndex(const std::string &fileName) const;
+
+	/** The k words whose vectors have the largest inner product with the query, as
+	 * (similarity, word) pairs with the most similar first. Searches the index if there is one,
+	 * otherwise compares with every word. */
+	std::vector<std::pair<float, wordID>> nearestNeighbors(const std::vector<float> &query, int k);
+
 	float commutativeSimilarity(wordID word1, wordID word2);
 	float similarity(wordID fixedWord, wordID dynWord);
+	void similarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords, int count,
+						  float *out);
+	void exactSimilarityMatrix(const std::vector<wordID> &fixedWords, const wordID *dynWords,
+							   int count, float *out);
 
 	/** True if the word2vec model includes a vector for the specified word */
 	bool wordExists(const std::string &word);
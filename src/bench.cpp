@@ -0,0 +1,598 @@
+#include "Dictionary.h"
+#include "EdgeListSimilarityEngine.h"
+#include "FuzzyBot.h"
+#include "InappropriateEngine.h"
+#include "Kernels.h"
+#include "MixingSimilarityEngine.h"
+#include "ProbabilityBot.h"
+#include "RandomSimilarityEngine.h"
+#include "Word2GMSimilarityEngine.h"
+#include "Word2VecSimilarityEngine.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define rep(i, a, b) for (int i = (a); i < int(b); ++i)
+#define trav(x, v) for (auto &x : v)
+#define all(v) (v).begin(), (v).end()
+
+// Number of calls to operator new, for the allocations per operation. Memory from
+// AlignedAllocator (posix_memalign) is not counted.
+static atomic<long long> allocations(0);
+
+void *operator new(size_t size) {
+	allocations.fetch_add(1, memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+
+// Not inlined, since GCC takes free on memory from the inlined operator new for a mismatch
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+namespace {
+
+// Keeps results alive so that the compiler cannot drop the measured work
+volatile float sink;
+
+// One libm call per element, as made by code that is not vectorized. Loops over std::exp
+// itself may be vectorized by the compiler (with glibc's libmvec at -Ofast).
+__attribute__((noinline)) float libmExp(float x) {
+	return std::exp(x);
+}
+
+__attribute__((noinline)) float libmSigmoid(float x) {
+	return 1 / (1 + std::exp(-x));
+}
+
+struct Measurement {
+	string name;
+	double nsPerOp;
+	double allocationsPerOp;
+};
+
+// Everything measured so far, in order
+vector<Measurement> measurements;
+
+/** Runs body (which performs opsPerCall operations) repeatedly for about a quarter of a second,
+ * prints the time and allocations per operation to stderr and records them */
+void measure(const string &name, int opsPerCall, const function<void()> &body) {
+	typedef chrono::steady_clock Clock;
+	body();
+	long long calls = 0;
+	long long allocationsBefore = allocations.load();
+	auto start = Clock::now();
+	double elapsed = 0;
+	for (long long batch = 1; elapsed < 0.25; batch *= 2) {
+		rep(i, 0, batch) {
+			body();
+		}
+		calls += batch;
+		elapsed = chrono::duration<double>(Clock::now() - start).count();
+	}
+	double ops = calls * (double)opsPerCall;
+	Measurement m{name, elapsed * 1e9 / ops, (allocations.load() - allocationsBefore) / ops};
+	measurements.push_back(m);
+	cerr << fixed << setprecision(2) << setw(48) << left << name << right << setw(14) << m.nsPerOp
+		 << " ns/op" << setprecision(0) << setw(12) << 1e9 / m.nsPerOp << " op/s"
+		 << setprecision(2) << setw(10) << m.allocationsPerOp << " alloc/op" << endl;
+	cerr.unsetf(ios::fixed);
+}
+
+/** Every stride-th float in [low, high], with the interval ends */
+vector<float> sweep(float low, float high, int stride) {
+	vector<float> values;
+	for (float x = low; x < high;) {
+		values.push_back(x);
+		uint32_t bits;
+		memcpy(&bits, &x, sizeof bits);
+		// Positive floats grow with their bits, negative ones shrink. The sign is taken from the
+		// bits, since subnormals compare equal to zero with -Ofast.
+		if (bits & 0x80000000u) {
+			bits = bits - stride < 0x80000000u ? 0 : bits - stride;
+		} else {
+			bits += stride;
+		}
+		memcpy(&x, &bits, sizeof x);
+	}
+	values.push_back(high);
+	return values;
+}
+
+struct ErrorStats {
+	double maxAbsolute = 0, maxRelative = 0;
+	float worstInput = 0;
+
+	void add(float x, float value, double exact) {
+		double absolute = abs((double)value - exact);
+		double relative = exact != 0 ? absolute / exact : 0;
+		maxAbsolute = max(maxAbsolute, absolute);
+		if (relative > maxRelative) {
+			maxRelative = relative;
+			worstInput = x;
+		}
+	}
+};
+
+void printErrors(const string &name, const ErrorStats &stats) {
+	cerr << setw(13) << name << "  max abs error " << setw(10) << stats.maxAbsolute
+		 << "  max rel error " << setw(10) << stats.maxRelative << " ("
+		 << stats.maxRelative / 0x1p-24 << " ulp) at x = " << stats.worstInput << endl;
+}
+
+void benchExp() {
+	cerr << "Kernels: " << kernelVariant() << ", exp: " << expVariant() << endl;
+
+	// Accuracy against double precision, over the whole clamped range
+	vector<float> inputs = sweep(EXP_MIN, EXP_MAX, 1001);
+	vector<float> outputs(inputs.size());
+	ErrorStats expArrayErrors, libmErrors, sigmoidErrors;
+	expArray(inputs.data(), outputs.data(), (int)inputs.size());
+	rep(i, 0, inputs.size()) {
+		double exact = exp((double)inputs[i]);
+		expArrayErrors.add(inputs[i], outputs[i], exact);
+		libmErrors.add(inputs[i], std::exp(inputs[i]), exact);
+	}
+	sigmoidArray(inputs.data(), outputs.data(), (int)inputs.size());
+	rep(i, 0, inputs.size()) {
+		sigmoidErrors.add(inputs[i], outputs[i], 1 / (1 + exp(-(double)inputs[i])));
+	}
+	cerr << setprecision(3);
+	cerr << inputs.size() << " inputs in [" << EXP_MIN << ", " << EXP_MAX << "]" << endl;
+	printErrors("expArray", expArrayErrors);
+	printErrors("std::exp", libmErrors);
+	printErrors("sigmoidArray", sigmoidErrors);
+
+	// Throughput on arguments like those of the fuzzy scores
+	const int n = 1024;
+	mt19937 rng(0);
+	uniform_real_distribution<float> distribution(-20, 20);
+	vector<float> in(n), out(n);
+	trav(x, in) {
+		x = distribution(rng);
+	}
+	struct Case {
+		string name;
+		function<void()> body;
+	};
+	vector<Case> cases = {
+		{"exp/libm", [&] { rep(i, 0, n) out[i] = libmExp(in[i]); }},
+		{"exp/libm loop", [&] { rep(i, 0, n) out[i] = std::exp(in[i]); }},
+		{"exp/expArray", [&] { expArray(in.data(), out.data(), n); }},
+		{"exp/libm sigmoid", [&] { rep(i, 0, n) out[i] = libmSigmoid(in[i]); }},
+		{"exp/sigmoidArray", [&] { sigmoidArray(in.data(), out.data(), n); }},
+	};
+	trav(c, cases) {
+		measure(c.name, n, [&] {
+			c.body();
+			sink = out[n - 1];
+		});
+	}
+}
+
+const char *WORD2VEC_FILE = "models/conceptnet.bin";
+const char *WORD2GM_FILE = "models/word2gm.bin";
+const char *WORDLIST_FILE = "wordlist-eng.txt";
+
+/** The Wikisaurus edges in the binary format written by preprocess if there are any, like the
+ * bots load them, otherwise in the text format */
+string wikisaurusFile() {
+	const string binaryFile = "generated_data/wikisaurus_edges.bin";
+	if (ifstream(binaryFile))
+		return binaryFile;
+	return "generated_data/wikisaurus_edges.txt";
+}
+
+// Number of words in the dictionary benchmarks and of candidates in the scoring benchmarks
+const int SAMPLE_SIZE = 4096;
+
+/** Loads a model into engine, or prints why it is skipped. Returns true if successful. */
+bool loadOrSkip(SimilarityEngine &engine, const string &fileName) {
+	if (!ifstream(fileName)) {
+		cerr << "Skipping " << fileName << ": not found" << endl;
+		return false;
+	}
+	if (!engine.load(fileName, false)) {
+		cerr << "Skipping " << fileName << ": unable to load" << endl;
+		return false;
+	}
+	return true;
+}
+
+/** count random word IDs among the first limit words of the dictionary */
+vector<wordID> randomWords(const Dictionary &dict, int limit, int count, int seed) {
+	mt19937 rng(seed);
+	uniform_int_distribution<int> distribution(0, max(min(limit, dict.size()) - 1, 0));
+	vector<wordID> res(count);
+	trav(id, res) {
+		id = wordID(distribution(rng));
+	}
+	return res;
+}
+
+void benchDictionary() {
+	Dictionary dict;
+	Word2GMSimilarityEngine engine(dict);
+	if (!loadOrSkip(engine, WORD2GM_FILE))
+		return;
+	vector<wordID> ids = randomWords(dict, dict.size(), SAMPLE_SIZE, 1);
+	vector<string> words, missing;
+	trav(id, ids) {
+		words.push_back(string(dict.getWord(id)));
+		missing.push_back(words.back() + "_missing");
+	}
+	measure("dictionary/getID", SAMPLE_SIZE, [&] {
+		int sum = 0;
+		trav(word, words) {
+			sum += dict.getID(word);
+		}
+		sink = (float)sum;
+	});
+	measure("dictionary/wordExists missing", SAMPLE_SIZE, [&] {
+		int found = 0;
+		trav(word, missing) {
+			found += dict.wordExists(word);
+		}
+		sink = (float)found;
+	});
+	measure("dictionary/getWord", SAMPLE_SIZE, [&] {
+		size_t length = 0;
+		trav(id, ids) {
+			length += dict.getWord(id).size();
+		}
+		sink = (float)length;
+	});
+}
+
+void benchLoad() {
+	auto bench = [](const string &name, const string &fileName,
+					const function<unique_ptr<SimilarityEngine>(Dictionary &)> &create) {
+		{
+			Dictionary dict;
+			if (!loadOrSkip(*create(dict), fileName))
+				return;
+		}
+		measure(name, 1, [&] {
+			Dictionary dict;
+			create(dict)->load(fileName, false);
+		});
+	};
+	bench("load/word2vec", WORD2VEC_FILE, [](Dictionary &dict) {
+		return unique_ptr<SimilarityEngine>(new Word2VecSimilarityEngine(dict));
+	});
+	bench("load/word2gm", WORD2GM_FILE, [](Dictionary &dict) {
+		return unique_ptr<SimilarityEngine>(new Word2GMSimilarityEngine(dict));
+	});
+
+	// Edges between words that the dictionary does not know are dropped while parsing, so the
+	// dictionary is filled from a model first, as the bots do
+	Dictionary dict;
+	Word2VecSimilarityEngine word2vec(dict);
+	EdgeListSimilarityEngine edges(dict);
+	string edgeFile = wikisaurusFile();
+	if (!loadOrSkip(word2vec, WORD2VEC_FILE) || !loadOrSkip(edges, edgeFile))
+		return;
+	measure("load/edge list", 1, [&] { EdgeListSimilarityEngine(dict).load(edgeFile, false); });
+}
+
+/** The similarity, commutativeSimilarity and similarityMatrix paths of an engine, on pairs of
+ * the first limit words */
+void benchEngine(const string &name, SimilarityEngine &engine, const Dictionary &dict, int limit) {
+	vector<wordID> a = randomWords(dict, limit, SAMPLE_SIZE, 2);
+	vector<wordID> b = randomWords(dict, limit, SAMPLE_SIZE, 3);
+	measure(name + "/similarity", SAMPLE_SIZE, [&] {
+		float sum = 0;
+		rep(i, 0, SAMPLE_SIZE) {
+			sum += engine.similarity(a[i], b[i]);
+		}
+		sink = sum;
+	});
+	measure(name + "/commutativeSimilarity", SAMPLE_SIZE, [&] {
+		float sum = 0;
+		rep(i, 0, SAMPLE_SIZE) {
+			sum += engine.commutativeSimilarity(a[i], b[i]);
+		}
+		sink = sum;
+	});
+
+	// Board-sized sets of fixed words against a block of candidates, as when scanning
+	vector<wordID> fixedWords(a.begin(), a.begin() + 25);
+	vector<float> out(fixedWords.size() * Bot::SCAN_BLOCK_SIZE);
+	int pairs = (int)fixedWords.size() * Bot::SCAN_BLOCK_SIZE;
+	measure(name + "/similarityMatrix (per pair)", pairs, [&] {
+		engine.similarityMatrix(fixedWords, b.data(), Bot::SCAN_BLOCK_SIZE, out.data());
+		sink = out[0];
+	});
+	measure(name + "/exactSimilarityMatrix (per pair)", pairs, [&] {
+		engine.exactSimilarityMatrix(fixedWords, b.data(), Bot::SCAN_BLOCK_SIZE, out.data());
+		sink = out[0];
+	});
+}
+
+void benchSimilarity() {
+	const pair<VectorType, const char *> vectorTypes[] = {
+		{VectorType::FP32, "fp32"}, {VectorType::FP16, "fp16"}, {VectorType::INT8, "int8"}};
+	trav(type, vectorTypes) {
+		Dictionary dict;
+		Word2VecSimilarityEngine engine(dict);
+		engine.vectorType = type.first;
+		engine.keepExactVectors = true;
+		if (loadOrSkip(engine, WORD2VEC_FILE)) {
+			benchEngine(string("word2vec ") + type.second, engine, dict, dict.size());
+		}
+	}
+	trav(type, vectorTypes) {
+		Dictionary dict;
+		Word2GMSimilarityEngine engine(dict);
+		engine.vectorType = type.first;
+		engine.keepExactVectors = true;
+		if (loadOrSkip(engine, WORD2GM_FILE)) {
+			benchEngine(string("word2gm ") + type.second, engine, dict, dict.size());
+		}
+	}
+
+	Dictionary dict;
+	unique_ptr<SimilarityEngine> word2vec(new Word2VecSimilarityEngine(dict));
+	unique_ptr<SimilarityEngine> edges(new EdgeListSimilarityEngine(dict));
+	if (!loadOrSkip(*word2vec, WORD2VEC_FILE) || !loadOrSkip(*edges, wikisaurusFile()))
+		return;
+	benchEngine("edge list", *edges, dict, dict.size());
+	RandomSimilarityEngine random;
+	benchEngine("random", random, dict, dict.size());
+	MixingSimilarityEngine mixing;
+	mixing.engine1 = move(word2vec);
+	mixing.engine2 = move(edges);
+	mixing.multiplier1 = 1;
+	mixing.multiplier2 = 0.5f;
+	benchEngine("mixing", mixing, dict, dict.size());
+}
+
+/** Puts a board of words from the word list that the engine knows on the bot: 9 of the team's
+ * own, 8 of the opponent, 7 civilians and the assassin. Returns false if there are too few. */
+bool setUpBoard(Bot &bot) {
+	ifstream fin(WORDLIST_FILE);
+	vector<string> words;
+	string line;
+	while (getline(fin, line)) {
+		string word = normalize(line);
+		if (bot.engine.wordExists(word))
+			words.push_back(word);
+	}
+	if (words.size() < 25) {
+		cerr << "Skipping the bots: fewer than 25 words of " << WORDLIST_FILE << " are known"
+			 << endl;
+		return false;
+	}
+	mt19937 rng(4);
+	shuffle(all(words), rng);
+	bot.setWords(vector<string>(words.begin(), words.begin() + 9),
+				 vector<string>(words.begin() + 9, words.begin() + 17),
+				 vector<string>(words.begin() + 17, words.begin() + 24),
+				 vector<string>(words.begin() + 24, words.begin() + 25));
+	return true;
+}
+
+float bestScore(const vector<Bot::Result> &results) {
+	return results.empty() ? 0 : results[0].score;
+}
+
+void benchBots() {
+	Dictionary dict;
+	Word2GMSimilarityEngine engine(dict);
+	if (!loadOrSkip(engine, WORD2GM_FILE))
+		return;
+	InappropriateEngine inappropriateEngine("inappropriate.txt", dict);
+	auto substringIndex = make_shared<SubstringIndex>(dict, dict.size());
+	const pair<Bot::Difficulty, const char *> difficulties[] = {
+		{Bot::Difficulty::EASY, "easy"},
+		{Bot::Difficulty::MEDIUM, "medium"},
+		{Bot::Difficulty::HARD, "hard"}};
+
+	trav(difficulty, difficulties) {
+		FuzzyBot bot(dict, engine, inappropriateEngine);
+		bot.setDifficulty(difficulty.first);
+		bot.numThreads = 1;
+		bot.substringIndex = substringIndex;
+		if (!setUpBoard(bot))
+			return;
+		vector<wordID> candidates = randomWords(dict, dict.size(), SAMPLE_SIZE, 5);
+		string prefix = string("fuzzy ") + difficulty.second;
+		measure(prefix + "/getWordScore", SAMPLE_SIZE, [&] {
+			float sum = 0;
+			trav(word, candidates) {
+				sum += bot.getWordScore(word, nullptr, true).first;
+			}
+			sink = sum;
+		});
+		// The similarities are cached between calls, so only the first call scans the engine
+		bot.similarityCache = SimilarityCache();
+		measure(prefix + "/findBestWords", 1, [&] {
+			bot.similarityCache = SimilarityCache();
+			sink = bestScore(bot.findBestWords(20));
+		});
+		measure(prefix + "/findBestWords cached", 1, [&] {
+			sink = bestScore(bot.findBestWords(20));
+		});
+	}
+
+	trav(difficulty, difficulties) {
+		ProbabilityBot bot(dict, engine, inappropriateEngine);
+		bot.setDifficulty(difficulty.first);
+		bot.numThreads = 1;
+		bot.substringIndex = substringIndex;
+		if (!setUpBoard(bot))
+			return;
+		string prefix = string("probability ") + difficulty.second;
+		vector<wordID> candidates = randomWords(dict, dict.size(), 64, 6);
+		measure(prefix + "/getProbabilityScore", (int)candidates.size(), [&] {
+			float sum = 0;
+			trav(word, candidates) {
+				sum += bot.getProbabilityScore(word, 2);
+			}
+			sink = sum;
+		});
+		measure(prefix + "/findBestWords", 1, [&] {
+			bot.similarityCache = SimilarityCache();
+			sink = bestScore(bot.findBestWords(20));
+		});
+	}
+}
+
+string escapeJSON(const string &s) {
+	string res;
+	trav(c, s) {
+		if (c == '"' || c == '\\')
+			res += '\\';
+		res += c;
+	}
+	return res;
+}
+
+/** The measurements as JSON, one per line. With a baseline, every measurement that is in it gets
+ * the baseline time and the ratio of the times. */
+void writeJSON(ostream &out, const vector<Measurement> &baseline) {
+	out << "{\"kernels\": \"" << kernelVariant() << "\", \"exp\": \"" << expVariant()
+		<< "\", \"benchmarks\": [";
+	rep(i, 0, measurements.size()) {
+		const Measurement &m = measurements[i];
+		out << (i ? ",\n" : "\n") << "  {\"name\": \"" << escapeJSON(m.name)
+			<< "\", \"ns_per_op\": " << m.nsPerOp << ", \"ops_per_second\": " << 1e9 / m.nsPerOp
+			<< ", \"allocations_per_op\": " << m.allocationsPerOp;
+		trav(b, baseline) {
+			if (b.name == m.name) {
+				out << ", \"baseline_ns_per_op\": " << b.nsPerOp
+					<< ", \"ratio\": " << m.nsPerOp / b.nsPerOp;
+			}
+		}
+		out << "}";
+	}
+	out << "\n]}" << endl;
+}
+
+/** Reads the measurements from the output of #writeJSON. Returns false if the file cannot be
+ * read. */
+bool readJSON(const string &fileName, vector<Measurement> &res) {
+	ifstream fin(fileName);
+	if (!fin)
+		return false;
+	auto field = [](const string &line, const string &key) -> size_t {
+		size_t pos = line.find("\"" + key + "\": ");
+		return pos == string::npos ? pos : pos + key.size() + 4;
+	};
+	string line;
+	while (getline(fin, line)) {
+		size_t name = field(line, "name"), ns = field(line, "ns_per_op"),
+			   alloc = field(line, "allocations_per_op");
+		if (name == string::npos || ns == string::npos || alloc == string::npos)
+			continue;
+		Measurement m;
+		// Names are written by #escapeJSON
+		for (size_t i = name + 1; i < line.size() && line[i] != '"'; i++) {
+			if (line[i] == '\\')
+				i++;
+			m.name += line[i];
+		}
+		m.nsPerOp = atof(line.c_str() + ns);
+		m.allocationsPerOp = atof(line.c_str() + alloc);
+		res.push_back(m);
+	}
+	return true;
+}
+
+/** Prints the measurements that are slower than in the baseline by more than the tolerance (a
+ * fraction), or allocate more. Returns the number of them. */
+int reportRegressions(const vector<Measurement> &baseline, double tolerance) {
+	int regressions = 0;
+	trav(m, measurements) {
+		trav(b, baseline) {
+			if (b.name != m.name)
+				continue;
+			bool slower = m.nsPerOp > b.nsPerOp * (1 + tolerance);
+			// Allow for rounding in the file and for allocations that are amortized over calls
+			bool allocates = m.allocationsPerOp > b.allocationsPerOp + 0.01;
+			if (slower || allocates) {
+				regressions++;
+				cerr << "Regression: " << m.name << ": " << b.nsPerOp << " -> " << m.nsPerOp
+					 << " ns/op, " << b.allocationsPerOp << " -> " << m.allocationsPerOp
+					 << " alloc/op" << endl;
+			}
+		}
+	}
+	return regressions;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+	const vector<pair<string, function<void()>>> suites = {
+		{"exp", benchExp},
+		{"dictionary", benchDictionary},
+		{"load", benchLoad},
+		{"similarity", benchSimilarity},
+		{"bots", benchBots},
+	};
+	string which = "all", baselineFile;
+	double tolerance = 0.1;
+	bool valid = true;
+	rep(i, 1, argc) {
+		string arg = argv[i];
+		if (arg == "--baseline" && i + 1 < argc) {
+			baselineFile = argv[++i];
+		} else if (arg == "--tolerance" && i + 1 < argc) {
+			tolerance = atof(argv[++i]) / 100;
+		} else if (arg[0] != '-' && which == "all") {
+			which = arg;
+		} else {
+			valid = false;
+		}
+	}
+	bool found = which == "all";
+	trav(suite, suites) {
+		found |= suite.first == which;
+	}
+	if (!valid || !found) {
+		cerr << "Usage: " << argv[0]
+			 << " [all|exp|dictionary|load|similarity|bots] [--baseline file] [--tolerance percent]"
+			 << endl;
+		return 1;
+	}
+
+	vector<Measurement> baseline;
+	if (!baselineFile.empty() && !readJSON(baselineFile, baseline)) {
+		cerr << "Unable to read " << baselineFile << endl;
+		return 1;
+	}
+	trav(suite, suites) {
+		if (which == "all" || which == suite.first) {
+			suite.second();
+		}
+	}
+	writeJSON(cout, baseline);
+	if (!baselineFile.empty()) {
+		int regressions = reportRegressions(baseline, tolerance);
+		cerr << regressions << " regressions against " << baselineFile << endl;
+		return regressions > 0 ? 2 : 0;
+	}
+	return 0;
+}
@@ -72,7 +72,7 @@ bool eval(Word2VecSimilarityEngine &engine, Dictionary &dict, const string &line
 	int dim = engine.dimension();
 	vector<float> vec(dim);
 	trav(pa, stuff) {
-		vector<float> vec2 = engine.getVector(dict.getID(pa.second));
+		const float *vec2 = engine.getVector(dict.getID(pa.second));
 		rep(i, 0, dim) {
 			vec[i] += pa.first * vec2[i];
 		}
@@ -136,10 +136,42 @@ string COLOR_YELLOW = "\033[33m";
 string COLOR_CYAN = "\033[36m";
 string RESET = "\033[0m";
 
-int main() {
+/** Builds the nearest neighbour index of a model and stores it next to the model file */
+int buildIndex(const string &modelFile, const HnswIndex::Params &params) {
 	Dictionary dict;
 	Word2VecSimilarityEngine engine(dict);
-	engine.load("data.bin", false);
+	if (!engine.load(modelFile, true))
+		return 1;
+	cerr << "Building index (M = " << params.M << ", ef = " << params.efConstruction << ")... "
+		 << flush;
+	engine.buildIndex(params);
+	string indexFile = Word2VecSimilarityEngine::indexFileName(modelFile);
+	if (!engine.saveIndex(indexFile)) {
+		cerr << "failed to write " << indexFile << endl;
+		return 1;
+	}
+	cerr << "wrote " << indexFile << endl;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	string modelFile = "data.bin";
+	if (argc >= 2 && argv[1] == string("--build-index")) {
+		HnswIndex::Params params;
+		if (argc >= 3)
+			modelFile = argv[2];
+		if (argc >= 4)
+			params.M = atoi(argv[3]);
+		if (argc >= 5)
+			params.efConstruction = atoi(argv[4]);
+		return buildIndex(modelFile, params);
+	}
+
+	Dictionary dict;
+	Word2VecSimilarityEngine engine(dict);
+	if (argc == 3 && argv[1] == string("--ef"))
+		engine.searchEf = atoi(argv[2]);
+	engine.load(modelFile, false);
 	const int dim = engine.dimension();
 	for (;;) {
 		string line;
@@ -170,8 +202,8 @@ int main() {
 				cout << COLOR_RED << "unknown word " << b << RESET << endl;
 				continue;
 			}
-			vector<float>& vec1 = const_cast<vector<float>&>(engine.getVector(dict.getID(a)));
-			const vector<float>& vec2 = engine.getVector(dict.getID(b));
+			float *vec1 = engine.getMutableVector(dict.getID(a));
+			const float *vec2 = engine.getVector(dict.getID(b));
 			int dim = engine.dimension();
 			float origNorm = 0, newNorm = 0;
 			rep(i, 0, dim) {
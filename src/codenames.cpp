@@ -1,4 +1,5 @@
 #include "Bot.h"
+#include "ClueServer.h"
 #include "Dictionary.h"
 #include "GameInterface.h"
 #include "InappropriateEngine.h"
@@ -9,14 +10,18 @@
 #include "EdgeListSimilarityEngine.h"
 #include "MixingSimilarityEngine.h"
 #include "RandomSimilarityEngine.h"
+#include "SelfPlay.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
 #include <random>
 #include <set>
@@ -32,6 +37,14 @@
 
 using namespace std;
 
+/** The Wikisaurus edge list, preferring the binary version made by "preprocess --edges" */
+string wikisaurusFile() {
+	const string binaryFile = "generated_data/wikisaurus_edges.bin";
+	if (ifstream(binaryFile))
+		return binaryFile;
+	return "generated_data/wikisaurus_edges.txt";
+}
+
 string escapeJSON(const string &s) {
 	string res;
 	auto hex = [](unsigned int c) -> char {
@@ -53,117 +66,163 @@ string escapeJSON(const string &s) {
 	return res;
 }
 
-void batchMain() {
+/** The model file of an engine name in a batch request, or an empty string if there is none */
+string batchModelFile(const string &engine) {
+	if (engine == "glove")
+		return "models/glove.840B.330d.bin";
+	else if (engine == "conceptnet")
+		return "models/conceptnet.bin";
+	else if (engine == "conceptnet-swe")
+		return "models/conceptnet-swedish.bin";
+	else if (engine == "word2gm")
+		return "models/word2gm.bin";
+	return "";
+}
+
+/** A model with the dictionary and inappropriate words that belong to it, which batch requests
+ * only read and can share */
+struct BatchModel {
+	Dictionary dict;
+	Word2GMSimilarityEngine engine;
+	unique_ptr<InappropriateEngine> inappropriateEngine;
+
+	// Shared by the bots of all requests if set, otherwise every bot builds its own
+	shared_ptr<const SubstringIndex> substringIndex;
+
+	BatchModel() : engine(dict) {}
+
+	/** Returns true if successful */
+	bool load(const string &engineName) {
+		if (!engine.load(batchModelFile(engineName), false))
+			return false;
+		inappropriateEngine.reset(new InappropriateEngine("inappropriate.txt", dict));
+		return true;
+	}
+};
+
+/** Returns the loaded model of an engine name, or null if it could not be loaded */
+typedef function<BatchModel *(const string &)> BatchModelSource;
+
+/** An invalid batch request, answered with status 0 */
+struct BatchFailure {
+	const char *message;
+};
+
+/** Reads the cards and settings of a board in the batch protocol into the bot, from after the
+ * color of the team up to "go". Civilians may also be marked with 'g', as in the output of
+ * generate-game.py. Returns the first word that the engine does not know, which ends the board
+ * early, or an empty string. Throws BatchFailure for invalid input. */
+string readBatchBoard(istream &in, char color, FuzzyBot &bot) {
 	typedef Bot::CardType CardType;
 	typedef Bot::Difficulty Difficulty;
-	auto fail = [](const char *message) {
-		cout << "{\"status\": 0, \"message\": \"" << message << "\"}";
-		exit(0);
-	};
+	auto fail = [](const char *message) { throw BatchFailure{message}; };
+
+	string type;
+	while (in >> type && type != "go") {
+		if (type == "hinted") {
+			string word;
+			in >> word;
+			bot.setHasInfo(word);
+			continue;
+		}
+		if (type == "clue") {
+			string word;
+			in >> word;
+			bot.addOldClue(word);
+			continue;
+		}
+		if (type == "difficulty") {
+			string difficulty;
+			in >> difficulty;
+			Difficulty diff;
+			if (difficulty == "easy")
+				diff = Difficulty::EASY;
+			else if (difficulty == "medium")
+				diff = Difficulty::MEDIUM;
+			else if (difficulty == "hard")
+				diff = Difficulty::HARD;
+			else
+				fail("Invalid difficulty.");
+			bot.setDifficulty(diff);
+			continue;
+		}
+		if (type == "plan") {
+			bot.usePlanning = true;
+			continue;
+		}
+		if (type == "inappropriate") {
+			string mode;
+			in >> mode;
+			if (mode == "block") {
+				bot.inappropriateMode = BlockInappropriate;
+			} else if (mode == "allow") {
+				bot.inappropriateMode = AllowInappropriate;
+			} else if (mode == "boost") {
+				bot.inappropriateMode = BoostInappropriate;
+			} else {
+				fail("Inappropriate inappropriate mode. Expected one of [block, allow, boost].");
+			}
+			continue;
+		}
+		CardType type2;
+		if (type == string(1, color))
+			type2 = CardType::MINE;
+		else if (type == "b" || type == "r")
+			type2 = CardType::OPPONENT;
+		else if (type == "c" || type == "g")
+			type2 = CardType::CIVILIAN;
+		else if (type == "a")
+			type2 = CardType::ASSASSIN;
+		else
+			fail("Invalid type.");
+
+		string word;
+		in >> word;
+		if (!bot.engine.wordExists(word))
+			return word;
+
+		bot.addBoardWord(type2, word);
+	}
+	return "";
+}
+
+/** Reads a request of the batch protocol from in and writes the JSON response to out. The bot uses
+ * numThreads threads (see #resolveThreadCount). */
+void answerBatchRequest(istream &in, ostream &out, const BatchModelSource &getModel,
+						int numThreads) {
+	typedef Bot::CardType CardType;
+	auto fail = [](const char *message) { throw BatchFailure{message}; };
 
 	try {
-		cin.exceptions(ios::failbit | ios::eofbit | ios::badbit);
+		in.exceptions(ios::failbit | ios::eofbit | ios::badbit);
 
 		string engine;
-		cin >> engine;
-		if (engine == "glove")
-			engine = "models/glove.840B.330d.bin";
-		else if (engine == "conceptnet")
-			engine = "models/conceptnet.bin";
-		else if (engine == "conceptnet-swe")
-			engine = "models/conceptnet-swedish.bin";
-		else if (engine == "word2gm")
-			engine = "models/word2gm.bin";
-		else
+		in >> engine;
+		if (batchModelFile(engine).empty())
 			fail("Invalid engine parameter.");
 
-		Dictionary dict;
-		Word2GMSimilarityEngine word2vecEngine(dict);
-		if (!word2vecEngine.load(engine, false))
+		BatchModel *model = getModel(engine);
+		if (!model)
 			fail("Unable to load similarity engine.");
 
-		InappropriateEngine inappropriateEngine("inappropriate.txt", dict);
-		FuzzyBot bot(dict, word2vecEngine, inappropriateEngine);
+		FuzzyBot bot(model->dict, model->engine, *model->inappropriateEngine);
+		bot.numThreads = numThreads;
+		bot.substringIndex = model->substringIndex;
 
 		char color;
-		cin >> color;
+		in >> color;
 		if (color != 'r' && color != 'b')
 			fail("Invalid color.");
 
-		string type;
-		while (cin >> type && type != "go") {
-			if (type == "hinted") {
-				string word;
-				cin >> word;
-				bot.setHasInfo(word);
-				continue;
-			}
-			if (type == "clue") {
-				string word;
-				cin >> word;
-				bot.addOldClue(word);
-				continue;
-			}
-			if (type == "difficulty") {
-				string difficulty;
-				cin >> difficulty;
-				Difficulty diff;
-				if (difficulty == "easy")
-					diff = Difficulty::EASY;
-				else if (difficulty == "medium")
-					diff = Difficulty::MEDIUM;
-				else if (difficulty == "hard")
-					diff = Difficulty::HARD;
-				else {
-					fail("Invalid difficulty.");
-					abort();
-				}
-				bot.setDifficulty(diff);
-				continue;
-			}
-			if (type == "inappropriate") {
-				string mode;
-				cin >> mode;
-				if (mode == "block") {
-					bot.inappropriateMode = BlockInappropriate;
-				} else if (mode == "allow") {
-					bot.inappropriateMode = AllowInappropriate;
-				} else if (mode == "boost") {
-					bot.inappropriateMode = BoostInappropriate;
-				} else {
-					fail(
-						"Inappropriate inappropriate mode. Expected one of [block, allow, boost].");
-					abort();
-				}
-				continue;
-			}
-			CardType type2;
-			if (type == string(1, color))
-				type2 = CardType::MINE;
-			else if (type == "b" || type == "r")
-				type2 = CardType::OPPONENT;
-			else if (type == "c")
-				type2 = CardType::CIVILIAN;
-			else if (type == "a")
-				type2 = CardType::ASSASSIN;
-			else {
-				fail("Invalid type.");
-				abort();
-			}
-
-			string word;
-			cin >> word;
-			if (!bot.engine.wordExists(word)) {
-				cout << "{\"status\": 2, \"message\": \"Unknown word: '"
-					 << escapeJSON(denormalize(word)) << "'.\"}";
-				return;
-			}
-
-			bot.addBoardWord(type2, word);
+		string unknownWord = readBatchBoard(in, color, bot);
+		if (!unknownWord.empty()) {
+			out << "{\"status\": 2, \"message\": \"Unknown word: '"
+				<< escapeJSON(denormalize(unknownWord)) << "'.\"}";
+			return;
 		}
 
 		int firstResult, numResults;
-		cin >> firstResult >> numResults;
+		in >> firstResult >> numResults;
 		if (firstResult < 0)
 			fail("Invalid index");
 		if (numResults <= 0)
@@ -173,7 +232,7 @@ void batchMain() {
 		vector<Bot::Result> results = bot.findBestWords(firstResult + numResults);
 
 		if (firstResult >= results.size()) {
-			cout << "{\"status\": 3, \"message\": \"No more clues.\"}";
+			out << "{\"status\": 3, \"message\": \"No more clues.\"}";
 			return;
 		}
 
@@ -195,30 +254,235 @@ void batchMain() {
 			assert(0 <= index && index < results.size());
 			string w = results[index].word;
 			int count = results[index].number;
-			cout << "  {\"word\": \"" << escapeJSON(denormalize(w)) << "\", ";
-			cout << "\"count\": " << count << ", \"why\": [";
+			out << "  {\"word\": \"" << escapeJSON(denormalize(w)) << "\", ";
+			out << "\"count\": " << count << ", \"why\": [";
 			bool first = true;
 			trav(item, results[index].valuations) {
-				cout << (first ? "\n" : ",\n") << "    {"
+				out << (first ? "\n" : ",\n") << "    {"
 					 << "\"score\": " << item.score << ", "
 					 << "\"word\": \"" << escapeJSON(denormalize(item.word)) << "\", "
 					 << "\"type\": \"" << type2chr(item.type) << "\"}";
 				first = false;
 			}
-			cout << "\n  ]}";
+			out << "\n  ]}";
 		};
 
-		cout << "{\"status\": 1, \"message\": \"Success.\", \"result\": [" << endl;
+		out << "{\"status\": 1, \"message\": \"Success.\", \"result\": [" << endl;
 		bool first = true;
 		rep(i, firstResult, min(firstResult + numResults, (int)results.size())) {
-			cout << (first ? "\n" : ",\n");
+			out << (first ? "\n" : ",\n");
 			printClue(i);
 			first = false;
 		}
-		cout << "\n]}";
-	} catch (ios::failure e) {
-		fail("Incomplete message.");
+		out << "\n]}";
+	} catch (const BatchFailure &failure) {
+		out << "{\"status\": 0, \"message\": \"" << failure.message << "\"}";
+	} catch (const ios::failure &) {
+		out << "{\"status\": 0, \"message\": \"Incomplete message.\"}";
+	}
+}
+
+void batchMain() {
+	unique_ptr<BatchModel> model;
+	answerBatchRequest(
+		cin, cout,
+		[&](const string &engine) -> BatchModel * {
+			model.reset(new BatchModel());
+			return model->load(engine) ? model.get() : nullptr;
+		},
+		0);
+}
+
+/** Finds clues for many boards at once with FuzzyBot::findBestWordsForBoards, for offline
+ * evaluation. Reads boards from standard input, each a color followed by its cards and settings as
+ * in a batch request (so the output of generate-game.py works), and writes one line of JSON with
+ * the best count clues of each board. */
+void batchBoardsMain(const string &engine, int count) {
+	// Boards that are scored together. More of them share more reads of the candidates, but every
+	// bot keeps a few bytes per candidate.
+	const int BOARDS_PER_PASS = 64;
+
+	if (batchModelFile(engine).empty()) {
+		cerr << "Invalid engine " << engine << endl;
+		return;
+	}
+	BatchModel model;
+	if (!model.load(engine)) {
+		cerr << "Unable to load " << batchModelFile(engine) << endl;
+		return;
+	}
+	model.substringIndex = make_shared<SubstringIndex>(model.dict, model.dict.size());
+
+	struct Board {
+		int index;
+		unique_ptr<FuzzyBot> bot;
+		string error;
+	};
+	cin.exceptions(ios::failbit | ios::badbit);
+	int numBoards = 0;
+	bool done = false;
+	while (!done) {
+		vector<Board> boards;
+		while (!done && (int)boards.size() < BOARDS_PER_PASS) {
+			cin >> ws;
+			if (cin.eof()) {
+				done = true;
+				break;
+			}
+			Board board;
+			board.index = numBoards++;
+			board.bot.reset(new FuzzyBot(model.dict, model.engine, *model.inappropriateEngine));
+			board.bot->substringIndex = model.substringIndex;
+			try {
+				char color;
+				cin >> color;
+				if (color != 'r' && color != 'b')
+					throw BatchFailure{"Invalid color."};
+				string unknownWord = readBatchBoard(cin, color, *board.bot);
+				if (!unknownWord.empty()) {
+					board.error = "{\"status\": 2, \"message\": \"Unknown word: '" +
+								  escapeJSON(denormalize(unknownWord)) + "'.\"}";
+					// Skip the rest of the board
+					string type;
+					while (cin >> type && type != "go") {
+					}
+				}
+			} catch (const BatchFailure &failure) {
+				// The rest of the input cannot be matched up with boards
+				board.error = "{\"status\": 0, \"message\": \"" + string(failure.message) + "\"}";
+				done = true;
+			} catch (const ios::failure &) {
+				board.error = "{\"status\": 0, \"message\": \"Incomplete board.\"}";
+				done = true;
+			}
+			boards.push_back(move(board));
+		}
+
+		vector<FuzzyBot *> bots;
+		trav(board, boards) {
+			if (board.error.empty()) {
+				bots.push_back(board.bot.get());
+			}
+		}
+		vector<vector<Bot::Result>> results = FuzzyBot::findBestWordsForBoards(bots, count, 0);
+		int next = 0;
+		trav(board, boards) {
+			cout << "{\"board\": " << board.index << ", ";
+			if (!board.error.empty()) {
+				cout << board.error.substr(1) << endl;
+				continue;
+			}
+			cout << "\"status\": 1, \"result\": [";
+			bool first = true;
+			trav(result, results[next++]) {
+				cout << (first ? "" : ", ") << "{\"word\": \""
+					 << escapeJSON(denormalize(result.word)) << "\", \"count\": " << result.number
+					 << ", \"score\": " << result.score << "}";
+				first = false;
+			}
+			cout << "]}" << endl;
+		}
+	}
+}
+
+/** Answers batch requests on a socket (see #ClueServer) until SIGINT or SIGTERM. Models are loaded
+ * on their first request, or in advance if given in preload, and then stay in memory. */
+void serveMain(const string &address, int numWorkers, const vector<string> &preload) {
+	struct Entry {
+		once_flag loaded;
+		unique_ptr<BatchModel> model;
+	};
+	map<string, Entry> models;
+	mutex modelsMutex;
+	BatchModelSource getModel = [&](const string &engine) -> BatchModel * {
+		Entry *entry;
+		{
+			lock_guard<mutex> lock(modelsMutex);
+			entry = &models[engine];
+		}
+		call_once(entry->loaded, [&] {
+			unique_ptr<BatchModel> model(new BatchModel());
+			if (model->load(engine)) {
+				model->substringIndex = make_shared<SubstringIndex>(model->dict, model->dict.size());
+				entry->model = move(model);
+			} else {
+				cerr << "Unable to load " << batchModelFile(engine) << endl;
+			}
+		});
+		return entry->model.get();
+	};
+
+	ClueServer server([&](istream &in, ostream &out) {
+		// Every request gets its share of the hardware threads
+		int threads = max(1, resolveThreadCount(0) / resolveThreadCount(numWorkers));
+		answerBatchRequest(in, out, getModel, threads);
+	});
+	if (!server.listen(address))
+		return;
+	trav(engine, preload) {
+		if (batchModelFile(engine).empty()) {
+			cerr << "Invalid engine " << engine << endl;
+			return;
+		}
+		getModel(engine);
+	}
+	cerr << "Serving on " << address << endl;
+	server.run(numWorkers);
+	cerr << "Stopped" << endl;
+}
+
+/** Plays games between two spymaster bots with simulated guessers and reports how often each
+ * wins (see #SelfPlay). Arguments: engine, number of games, then optionally the red and blue
+ * spymasters (like "fuzzy-medium"), the guesser noise, the seed and the number of threads. */
+void selfPlayMain(const vector<string> &args) {
+	if (args.size() < 2) {
+		cerr << "Usage: codenames --self-play <engine> <games> [red spymaster] [blue spymaster] "
+				"[noise] [seed] [threads]"
+			 << endl;
+		return;
+	}
+	const string &engine = args[0];
+	int games = stoi(args[1]);
+	BatchModel model;
+	if (batchModelFile(engine).empty() || !model.load(engine)) {
+		cerr << "Unable to load engine " << engine << endl;
+		return;
+	}
+
+	SelfPlay selfPlay(model.dict, model.engine, *model.inappropriateEngine, model.engine);
+	selfPlay.substringIndex = make_shared<SubstringIndex>(model.dict, model.dict.size());
+	rep(team, 0, 2) {
+		if ((int)args.size() > 2 + team && !SelfPlay::Spymaster::parse(args[2 + team],
+																	  selfPlay.spymasters[team])) {
+			cerr << "Invalid spymaster " << args[2 + team]
+				 << ", expected fuzzy or probability and a difficulty, like fuzzy-medium" << endl;
+			return;
+		}
+	}
+	if (args.size() > 4)
+		selfPlay.noise = stof(args[4]);
+	if (args.size() > 5)
+		selfPlay.seed = stoull(args[5]);
+	if (args.size() > 6)
+		selfPlay.numThreads = stoi(args[6]);
+	if (!selfPlay.loadWords("wordlist-eng.txt") || !selfPlay.prepare()) {
+		cerr << "Too few words of wordlist-eng.txt are known to the engine" << endl;
+		return;
 	}
+
+	SelfPlay::Report report = selfPlay.run(games);
+	const char *teams[] = {"red", "blue"};
+	cout << "Played " << report.games << " games in " << report.seconds << " s ("
+		 << report.games / report.seconds << " games/s, " << resolveThreadCount(selfPlay.numThreads)
+		 << " threads)" << endl;
+	rep(team, 0, 2) {
+		cout << teams[team] << " (" << selfPlay.spymasters[team].name()
+			 << "): " << report.wins[team] << " wins ("
+			 << 100.0 * report.wins[team] / max(report.games, 1) << "%), "
+			 << "lost " << report.assassinLosses[team] << " by the assassin" << endl;
+	}
+	cout << "Draws: " << report.draws << endl;
+	cout << "Average turns: " << (double)report.turns / max(report.games, 1) << endl;
 }
 
 void simMain() {
@@ -387,7 +651,7 @@ void extractFeatures(string trainFileName, string testFileName) {
 		cerr << "Unable to load similarity engine.";
 
 	EdgeListSimilarityEngine wikisaurus(dict);
-	if (!wikisaurus.load("generated_data/wikisaurus_edges.txt", false))
+	if (!wikisaurus.load(wikisaurusFile(), false))
 		cerr << "Unable to load wikisaurus similarity engine.";
 
 	/*EdgeListSimilarityEngine cluster(dict);
@@ -567,7 +831,7 @@ void benchSimilarity() {
 		cerr << "Unable to load similarity engine.";
 
 	auto wikisaurus = unique_ptr<SimilarityEngine>(new EdgeListSimilarityEngine(dict));
-	if (!wikisaurus->load("generated_data/wikisaurus_edges.txt", false))
+	if (!wikisaurus->load(wikisaurusFile(), false))
 		cerr << "Unable to load wikisaurus similarity engine.";
 
 	auto randSimilarity = unique_ptr<SimilarityEngine>(new RandomSimilarityEngine());
@@ -671,7 +935,7 @@ void serverMain() {
 		cerr << "Unable to load similarity engine.";
 	
 	EdgeListSimilarityEngine wikisaurus(dict);
-	if (!wikisaurus.load("generated_data/wikisaurus_edges.txt", false))
+	if (!wikisaurus.load(wikisaurusFile(), false))
 		cerr << "Unable to load wikisaurus similarity engine.";
 
 
@@ -699,7 +963,7 @@ void serverMain() {
 	cout << "Loaded Code Names word list with " << wordList.size() << " words" << endl;
 
 	while (true) {
-		string query = dict.getWord(words[rand() % words.size()]);
+		string query(dict.getWord(words[rand() % words.size()]));
 		
 		// Reject most words without wikisaurus links
 		if(rand()%5){
@@ -841,6 +1105,22 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
+	if (argc >= 3 && argv[1] == string("--batch-boards")) {
+		batchBoardsMain(argv[2], argc >= 4 ? atoi(argv[3]) : 20);
+		return 0;
+	}
+
+	if (argc >= 2 && argv[1] == string("--self-play")) {
+		selfPlayMain(vector<string>(argv + 2, argv + argc));
+		return 0;
+	}
+
+	if (argc >= 3 && argv[1] == string("--serve")) {
+		int numWorkers = argc >= 4 ? atoi(argv[3]) : 0;
+		serveMain(argv[2], numWorkers, vector<string>(argv + min(argc, 4), argv + argc));
+		return 0;
+	}
+
 	if (argc == 2 && argv[1] == string("--optimize-similarity")) {
 		optimizeSimilarity();
 		return 0;
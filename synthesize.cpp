@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "src/Dictionary.h"
+#include "src/ModelFile.h"
+using namespace std;
+
+#define rep(i, a, b) for(int i = (a); i < int(b); ++i)
+#define trav(x, v) for(auto& x : v)
+#define sz(x) (int)(x).size()
+#define all(v) (v).begin(), (v).end()
+
+// Model ids that the engines treat specially (see Word2VecSimilarityEngine::Models)
+const int GLOVE = 1, CONCEPTNET = 2, WORD2GM = 3;
+
+// The words of the word list are placed among this many most common words, where the bots look
+// for clues
+const int COMMON_WORDS = 10000;
+
+// Mixture components per word in Word2GM models (Word2GMSimilarityEngine::COMPONENTS)
+const int GM_COMPONENTS = 2;
+
+struct Settings {
+	int words = 50000;
+	int dim = 300;
+	int gmDim = 50;
+	int clusters = 500;
+	// Standard deviation of a word around its cluster center, relative to the spread of the centers
+	float spread = 0.6f;
+	// Probability that the second component of a Word2GM word is a different sense, in another
+	// cluster
+	float polysemy = 0.2f;
+	int edgesPerWord = 2;
+	uint64_t seed = 1;
+	int version = 1;
+	VectorType vectorType = VectorType::FP32;
+	set<string> models = {"conceptnet", "glove", "word2gm", "wikisaurus"};
+	string wordlistFile = "wordlist-eng.txt";
+	string outDir;
+};
+
+// Made up word number i: two or more consonant-vowel syllables, numbered bijectively so that
+// every name is distinct
+string syntheticName(long long i) {
+	const string consonants = "bdfghklmnprstvz", vowels = "aeiou";
+	const long long syllables = sz(consonants) * sz(vowels);
+	string res;
+	i += syllables;
+	do {
+		int s = (int)(i % syllables);
+		res += consonants[s / sz(vowels)];
+		res += vowels[s % sz(vowels)];
+		i = i / syllables - 1;
+	} while (i >= 0);
+	return res;
+}
+
+// The vocabulary in order of popularity: the normalized words of the word list at random positions
+// among the common words, and made up words everywhere else
+vector<string> makeVocabulary(const Settings& settings, mt19937_64& rng) {
+	vector<string> wordlist;
+	set<string> seen;
+	ifstream fin(settings.wordlistFile);
+	if (!fin) {
+		cerr << "Warning: missing " << settings.wordlistFile << ", so boards will not resolve."
+			 << endl;
+	}
+	string line;
+	while (getline(fin, line)) {
+		while (!line.empty() && isspace((unsigned char)line.back())) line.pop_back();
+		string word = normalize(line);
+		if (!word.empty() && seen.insert(word).second) wordlist.push_back(word);
+	}
+	if (sz(wordlist) > settings.words) {
+		cerr << "Warning: only " << settings.words << " of the " << sz(wordlist)
+			 << " words of the word list fit in the vocabulary." << endl;
+		wordlist.resize(settings.words);
+	}
+
+	vector<int> positions(min(settings.words, max(COMMON_WORDS, sz(wordlist))));
+	rep(i, 0, sz(positions)) positions[i] = i;
+	shuffle(all(positions), rng);
+	positions.resize(wordlist.size());
+	sort(all(positions));
+
+	vector<string> vocabulary(settings.words);
+	rep(i, 0, sz(wordlist)) vocabulary[positions[i]] = wordlist[i];
+	long long next = 0;
+	trav(word, vocabulary) {
+		while (word.empty()) {
+			string name = syntheticName(next++);
+			if (!seen.count(name)) word = name;
+		}
+	}
+	return vocabulary;
+}
+
+// Cluster centers with independent standard normal coordinates
+vector<vector<float>> makeCenters(int clusters, int dim, mt19937_64& rng) {
+	normal_distribution<float> normal;
+	vector<vector<float>> centers(clusters, vector<float>(dim));
+	trav(center, centers) trav(x, center) x = normal(rng);
+	return centers;
+}
+
+// Normalizes v and returns its squared norm, as stored in the model files
+float normalizeVector(vector<float>& v) {
+	double norm = 0;
+	trav(x, v) norm += (double)x * x;
+	float mu = norm > 0 ? (float)(1 / sqrt(norm)) : 0;
+	trav(x, v) x *= mu;
+	return (float)norm;
+}
+
+// Writes a model with one normalized vector per word, in the version 1 format that
+// preprocess.cpp writes (streamed, so any vocabulary size fits in memory) or the version 2 format
+// (which holds all vectors in memory). vectorOf(i, out) fills the unnormalized vector of word i.
+bool writeModel(const Settings& settings, const string& fileName, int modelid, int dim,
+				const vector<string>& vocabulary,
+				const function<void(int, vector<float>&)>& vectorOf) {
+	int count = sz(vocabulary);
+	vector<float> vec(dim);
+	if (settings.version == ModelHeader::VERSION) {
+		vector<float> norms(count), vectors;
+		vectors.reserve((size_t)count * dim);
+		rep(i, 0, count) {
+			vectorOf(i, vec);
+			norms[i] = normalizeVector(vec);
+			vectors.insert(vectors.end(), all(vec));
+		}
+		return writeModelFile(fileName, modelid, dim, vocabulary, norms, vectors,
+							  settings.vectorType);
+	}
+
+	ofstream fout(fileName, ios::binary);
+	int sentinel = -1, version = 1;
+	fout.write((char*)&sentinel, sizeof sentinel);
+	fout.write((char*)&version, sizeof version);
+	fout.write((char*)&modelid, sizeof modelid);
+	fout.write((char*)&count, sizeof count);
+	fout.write((char*)&dim, sizeof dim);
+	rep(i, 0, count) {
+		vectorOf(i, vec);
+		float norm = normalizeVector(vec);
+		int len = sz(vocabulary[i]);
+		fout.write((char*)&len, sizeof len);
+		fout.write(vocabulary[i].data(), len);
+		fout.write((char*)&norm, sizeof norm);
+		fout.write((char*)vec.data(), dim * sizeof(float));
+	}
+	if (!fout) {
+		cerr << "Failed to write " << fileName << endl;
+		return false;
+	}
+	return true;
+}
+
+// Word vectors around the center of the cluster of each word. Their squared norms are around
+// normScale, varying like the norms of real GloVe vectors, which the GloVe engine uses.
+bool writeWord2Vec(const Settings& settings, const string& fileName, int modelid,
+				   const vector<string>& vocabulary, const vector<int>& cluster, float normScale) {
+	mt19937_64 rng(settings.seed * 1000003 + modelid);
+	vector<vector<float>> centers = makeCenters(settings.clusters, settings.dim, rng);
+	normal_distribution<float> normal;
+	float scale = sqrt(normScale / (settings.dim * (1 + settings.spread * settings.spread)));
+	auto vectorOf = [&](int i, vector<float>& v) {
+		const vector<float>& center = centers[cluster[i]];
+		float wordScale = scale * exp(0.3f * normal(rng));
+		rep(k, 0, settings.dim) v[k] = (center[k] + settings.spread * normal(rng)) * wordScale;
+	};
+	return writeModel(settings, fileName, modelid, settings.dim, vocabulary, vectorOf);
+}
+
+// Word2GM vectors: per component a log sigma followed by the mean. The first mean lies around
+// the center of the cluster of the word, the second one close to it or, for polysemous words,
+// around another cluster. The means are scaled so that squared distances within a cluster are
+// around 2 spread^2 and between clusters around 2 (1 + spread^2), where the similarity of the
+// engine changes the most.
+bool writeWord2GM(const Settings& settings, const string& fileName,
+				  const vector<string>& vocabulary, const vector<int>& cluster) {
+	mt19937_64 rng(settings.seed * 1000003 + WORD2GM);
+	int gmDim = settings.gmDim, dim = GM_COMPONENTS * (1 + gmDim);
+	vector<vector<float>> centers = makeCenters(settings.clusters, gmDim, rng);
+	normal_distribution<float> normal;
+	uniform_real_distribution<float> uniform;
+	uniform_int_distribution<int> anyCluster(0, settings.clusters - 1);
+	float scale = 1 / sqrt((float)gmDim);
+	return writeModel(settings, fileName, WORD2GM, dim, vocabulary, [&](int i, vector<float>& v) {
+		rep(c, 0, GM_COMPONENTS) {
+			float* component = &v[c * (1 + gmDim)];
+			component[0] = -1 + 0.1f * normal(rng);
+			bool otherSense = c > 0 && uniform(rng) < settings.polysemy;
+			const vector<float>& center = centers[otherSense ? anyCluster(rng) : cluster[i]];
+			float spread = c > 0 && !otherSense ? settings.spread * 1.2f : settings.spread;
+			rep(k, 0, gmDim) component[1 + k] = (center[k] + spread * normal(rng)) * scale;
+		}
+	});
+}
+
+// Edges from every word to a few random words of its cluster, in the text format of
+// generated_data/wikisaurus_edges.txt
+bool writeEdges(const Settings& settings, const string& fileName, const vector<string>& vocabulary,
+				const vector<int>& cluster) {
+	mt19937_64 rng(settings.seed * 1000003 + 4);
+	vector<vector<int>> members(settings.clusters);
+	rep(i, 0, sz(vocabulary)) members[cluster[i]].push_back(i);
+	ostringstream edges;
+	long long numEdges = 0;
+	rep(i, 0, sz(vocabulary)) {
+		const vector<int>& m = members[cluster[i]];
+		if (sz(m) < 2) continue;
+		uniform_int_distribution<int> pick(0, sz(m) - 1);
+		set<int> targets;
+		rep(e, 0, min(settings.edgesPerWord, sz(m) - 1)) {
+			int j = m[pick(rng)];
+			if (j != i && targets.insert(j).second) {
+				edges << vocabulary[i] << ' ' << vocabulary[j] << " 1\n";
+				numEdges++;
+			}
+		}
+	}
+	ofstream fout(fileName);
+	fout << numEdges << '\n' << edges.str();
+	if (!fout) {
+		cerr << "Failed to write " << fileName << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Settings settings;
+	bool valid = true;
+	rep(i, 1, argc) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--words" && hasValue) settings.words = atoi(argv[++i]);
+		else if (arg == "--dim" && hasValue) settings.dim = atoi(argv[++i]);
+		else if (arg == "--gm-dim" && hasValue) settings.gmDim = atoi(argv[++i]);
+		else if (arg == "--clusters" && hasValue) settings.clusters = atoi(argv[++i]);
+		else if (arg == "--spread" && hasValue) settings.spread = (float)atof(argv[++i]);
+		else if (arg == "--polysemy" && hasValue) settings.polysemy = (float)atof(argv[++i]);
+		else if (arg == "--edges" && hasValue) settings.edgesPerWord = atoi(argv[++i]);
+		else if (arg == "--seed" && hasValue) settings.seed = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--wordlist" && hasValue) settings.wordlistFile = argv[++i];
+		else if (arg == "--models" && hasValue) {
+			settings.models.clear();
+			stringstream ss(argv[++i]);
+			string name;
+			while (getline(ss, name, ',')) settings.models.insert(name);
+		}
+		else if (arg == "--v2") settings.version = ModelHeader::VERSION;
+		else if (arg == "--vector-type" && hasValue) {
+			string type = argv[++i];
+			if (type == "fp16") settings.vectorType = VectorType::FP16;
+			else if (type == "int8") settings.vectorType = VectorType::INT8;
+			else if (type != "fp32") valid = false;
+		}
+		else if (arg[0] != '-' && settings.outDir.empty()) settings.outDir = arg;
+		else valid = false;
+	}
+	for (const string& name : settings.models) {
+		if (name != "conceptnet" && name != "glove" && name != "word2gm" && name != "wikisaurus")
+			valid = false;
+	}
+	if (!valid || settings.outDir.empty() || settings.words < 1 || settings.dim < 1 ||
+		settings.gmDim < 1 || settings.clusters < 1) {
+		cerr << "Usage: " << argv[0] << " [options] <output directory>" << endl;
+		cerr << endl;
+		cerr << "Writes made up models with the file names that the bots load, under <output directory>:" << endl;
+		cerr << " models/conceptnet.bin, models/glove.840B.330d.bin and models/word2gm.bin," << endl;
+		cerr << " and generated_data/wikisaurus_edges.txt. Copy inappropriate.txt and wordlist-eng.txt" << endl;
+		cerr << " there and run the programs from that directory." << endl;
+		cerr << endl;
+		cerr << "* Every word belongs to one of a number of clusters, and its vectors lie around the" << endl;
+		cerr << " centers of its cluster, so words of a cluster are similar and make good clues for" << endl;
+		cerr << " each other. The words of the word list are among the " << COMMON_WORDS << " most common words," << endl;
+		cerr << " the others are made up. The same options and seed give the same files." << endl;
+		cerr << endl;
+		cerr << "Options:" << endl;
+		cerr << " --words <count>       vocabulary size (default 50000)" << endl;
+		cerr << " --dim <dimension>     dimension of the word2vec models (default 300)" << endl;
+		cerr << " --gm-dim <dimension>  dimension of each Word2GM mean (default 50)" << endl;
+		cerr << " --clusters <count>    number of clusters (default 500)" << endl;
+		cerr << " --spread <s>          spread of words around their cluster center, relative to the" << endl;
+		cerr << "                       spread of the centers (default 0.6)" << endl;
+		cerr << " --polysemy <p>        probability that a Word2GM word has a second sense in another" << endl;
+		cerr << "                       cluster (default 0.2)" << endl;
+		cerr << " --edges <count>       edges per word in the edge list (default 2)" << endl;
+		cerr << " --seed <seed>         random seed (default 1)" << endl;
+		cerr << " --wordlist <file>     words that must be in the models (default wordlist-eng.txt)" << endl;
+		cerr << " --models <list>       comma separated subset of conceptnet,glove,word2gm,wikisaurus" << endl;
+		cerr << " --v2                  write the memory-mapped version 2 format, which holds all" << endl;
+		cerr << "                       vectors in memory while writing" << endl;
+		cerr << " --vector-type <type>  fp32, fp16 or int8 vectors in the version 2 format" << endl;
+		return 1;
+	}
+
+	mt19937_64 rng(settings.seed);
+	vector<string> vocabulary = makeVocabulary(settings, rng);
+	vector<int> cluster(vocabulary.size());
+	uniform_int_distribution<int> anyCluster(0, settings.clusters - 1);
+	trav(c, cluster) c = anyCluster(rng);
+
+	filesystem::path dir(settings.outDir);
+	error_code error;
+	filesystem::create_directories(dir / "models", error);
+	filesystem::create_directories(dir / "generated_data", error);
+
+	auto run = [&](const string& name, const filesystem::path& file,
+				   const function<bool()>& write) {
+		if (!settings.models.count(name)) return;
+		cerr << "Writing " << file.string() << "... " << flush;
+		if (!write()) exit(1);
+		cerr << "done" << endl;
+	};
+	filesystem::path conceptnet = dir / "models" / "conceptnet.bin";
+	filesystem::path glove = dir / "models" / "glove.840B.330d.bin";
+	filesystem::path word2gm = dir / "models" / "word2gm.bin";
+	filesystem::path edges = dir / "generated_data" / "wikisaurus_edges.txt";
+	run("conceptnet", conceptnet, [&] {
+		return writeWord2Vec(settings, conceptnet.string(), CONCEPTNET, vocabulary, cluster, 1);
+	});
+	run("glove", glove, [&] {
+		return writeWord2Vec(settings, glove.string(), GLOVE, vocabulary, cluster, 40);
+	});
+	run("word2gm", word2gm, [&] {
+		return writeWord2GM(settings, word2gm.string(), vocabulary, cluster);
+	});
+	run("wikisaurus", edges, [&] {
+		return writeEdges(settings, edges.string(), vocabulary, cluster);
+	});
+	return 0;
+}